@@ -22,10 +22,63 @@
 //#include <cmemory>
 #include <cassert>
 #include <cstdint>
+#include <algorithm>
+#if defined(_OPENMP)
+# include <omp.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+# include <unistd.h>
+#endif
 
 #include "cregion.hpp"
 #include "cpixmap.hpp"
 
+#define CACHELINE_ALIGN(bytes) (((bytes) + 63) & -64)
+
+// how pixels outside of an image are made up
+typedef enum {
+  BORDER_ZERO = 0,        // 000|abcd|000
+  BORDER_REPLICATE = 1,   // aaa|abcd|ddd
+  BORDER_REFLECT_101 = 2, // dcb|abcd|cba
+  BORDER_WRAP = 3,        // bcd|abcd|abc
+  BORDER_CONSTANT = 4     // vvv|abcd|vvv
+} border_t;
+
+// index inside [0, len) standing for i, or -1 when the border is a fixed value
+inline int mapBorder(int i, int len, border_t border)
+{
+  if (i >= 0 && i < len) return i;
+
+  switch (border) {
+  case BORDER_REPLICATE:
+    return (i < 0) ? 0 : len-1;
+  case BORDER_REFLECT_101:
+    if (len == 1) return 0;
+    while (i < 0 || i >= len) i = (i < 0) ? -i : ((len-1)<<1) - i;
+    return i;
+  case BORDER_WRAP:
+    i %= len;
+    return (i < 0) ? i + len : i;
+  default:
+    return -1;
+  }
+}
+
+// fills the padding on both sides of a line from its own pixels
+template <typename T>
+void fillBorder(T *line, size_t len, size_t padding, border_t border, T value = 0)
+{
+  if (border == BORDER_ZERO) value = 0;
+  for (int i = -(int)padding; i < 0; ++i) {
+    int j = mapBorder(i, (int)len, border);
+    line[i] = (j < 0) ? value : line[j];
+  }
+  for (int i = (int)len; i < (int)(len + padding); ++i) {
+    int j = mapBorder(i, (int)len, border);
+    line[i] = (j < 0) ? value : line[j];
+  }
+}
+
 // so called a tile of image
 template <typename T>
 class cchunk {
@@ -36,18 +89,28 @@ public:
   void setDimension(size_t width, size_t height, size_t hpadding, size_t vpadding);
   void draft(const cpixmap<T>& image, size_t x = 0, size_t y = 0, size_t z = 0);
   void shiftByNextLines(size_t lines_to_read, const cpixmap<T>& image, size_t z = 0);
+  void shiftByLine(const T *line);
   T& operator() (int y, int x);
+  T *getLine(int y);
+  T *getBufferLine(size_t i);
+  void setBorder(border_t border, T value = 0) { m_border = border, m_border_value = value; }
 private:
   void reallocate(size_t lines, size_t stride);
+  void loadLine(T *line, const cpixmap<T>& image, int y, size_t z);
   size_t m_width;
   size_t m_height;
   size_t m_horizontal_padding;
   size_t m_vertical_padding;
   size_t m_stride;
+  size_t m_offset; // bytes ahead of the x origin in a line, cache line aligned
   int m_horizontal_start;
   int m_vertical_start;
+  size_t m_head; // ring index of the top line
   uint8_t *m_buffer;
-  T **m_line_buffer;
+  uint8_t *m_aligned_buffer;
+  T **m_line_buffer; // ring of lines, mirrored twice so that any rotation is contiguous
+  border_t m_border;
+  T m_border_value;
 };
 
 template <typename T>
@@ -57,10 +120,15 @@ cchunk<T>::cchunk(void)
     m_horizontal_padding(0),
     m_vertical_padding(0),
     m_stride(0),
+    m_offset(0),
     m_horizontal_start(0),
     m_vertical_start(0),
+    m_head(0),
     m_buffer(NULL),
-    m_line_buffer(NULL) {}
+    m_aligned_buffer(NULL),
+    m_line_buffer(NULL),
+    m_border(BORDER_REPLICATE),
+    m_border_value(0) {}
 
 template <typename T>
 cchunk<T>::cchunk(size_t width, size_t height, size_t hpadding, size_t vpadding)
@@ -69,10 +137,15 @@ cchunk<T>::cchunk(size_t width, size_t height, size_t hpadding, size_t vpadding)
     m_horizontal_padding(0),
     m_vertical_padding(0),
     m_stride(0),
+    m_offset(0),
     m_horizontal_start(0),
     m_vertical_start(0),
+    m_head(0),
     m_buffer(NULL),
-    m_line_buffer(NULL)
+    m_aligned_buffer(NULL),
+    m_line_buffer(NULL),
+    m_border(BORDER_REPLICATE),
+    m_border_value(0)
 {
   setDimension(width, height, hpadding, vpadding);
 }
@@ -91,7 +164,8 @@ void cchunk<T>::setDimension(size_t width, size_t height, size_t hpadding, size_
   m_height = height;
   m_horizontal_padding = hpadding;
   m_vertical_padding = vpadding;
-  m_stride = QWORD_ALIGN((width + (hpadding<<1)) * sizeof(T));
+  m_offset = CACHELINE_ALIGN(hpadding * sizeof(T));
+  m_stride = CACHELINE_ALIGN(m_offset + (width + hpadding) * sizeof(T));
 
   reallocate(height + (vpadding<<1), m_stride);
 }
@@ -107,21 +181,10 @@ void cchunk<T>::draft(const cpixmap<T>& image, size_t x, size_t y, size_t z)
   m_vertical_start = y - m_vertical_padding;
     
   size_t lines = m_height + (m_vertical_padding<<1);    
-  std::memset(m_buffer, 0, lines * m_stride);
-    
-  for (size_t i = 0; i < lines; i++)
-    m_line_buffer[i] = (T *)(m_buffer + i*m_stride);
+  m_head = 0;
 
-  size_t hoffset = std::max(m_horizontal_start, 0) - m_horizontal_start;
-  size_t voffset = std::max(m_vertical_start, 0) - m_vertical_start;
-
-  for (size_t i = voffset; i < lines; i++) {
-    image.readHLine(m_line_buffer[i] + hoffset,
-		    m_width + (m_horizontal_padding<<1) - hoffset,
-		    m_horizontal_start+hoffset,
-		    m_vertical_start+i,
-		    z);
-  }
+  for (size_t i = 0; i < lines; i++)
+    loadLine(m_line_buffer[m_head + i], image, m_vertical_start + (int)i, z);
 }
 
 template <typename T>
@@ -135,32 +198,61 @@ void cchunk<T>::shiftByNextLines(size_t lines_to_read, const cpixmap<T>& image,
     
   assert(lines_to_read <= lines_allocated);
 
-  T *temp[lines_to_read];
-  for (size_t i = 0; i < lines_to_read; i++)
-    temp[i] = m_line_buffer[i];
-
-  for (size_t i = lines_to_read; i < lines_allocated; i++)
-    m_line_buffer[i - lines_to_read] = m_line_buffer[i];
-
-  for (size_t i = 0; i < lines_to_read; i++)
-    m_line_buffer[lines_allocated - lines_to_read + i] = temp[i];
-
+  // the top lines leave the ring and are reused at the bottom
+  m_head = (m_head + lines_to_read) % lines_allocated;
   m_vertical_start += lines_to_read;
 
-  size_t hoffset = std::max(m_horizontal_start, 0) - m_horizontal_start;
-     
   for (size_t i = 0; i < lines_to_read; i++) {
     size_t voffset = lines_allocated - lines_to_read + i;
-    size_t line = (size_t)(m_vertical_start + voffset);
-    if (line < image.getHeight()) {
-      image.readHLine(m_line_buffer[voffset] + hoffset,
-		      m_width + (m_horizontal_padding<<1) - hoffset,
-		      m_horizontal_start + hoffset,
-		      m_vertical_start + voffset,
-		      z);
-    } else {
-      std::memset(m_line_buffer[voffset], 0, m_stride);
-    }
+    loadLine(m_line_buffer[m_head + voffset], image, m_vertical_start + (int)voffset, z);
+  }
+}
+
+// shifts by one line taken from a row of width pixels instead of an image,
+// so that rows can be streamed in; the horizontal padding follows the border policy
+template <typename T>
+void cchunk<T>::shiftByLine(const T *line)
+{
+  assert(m_buffer);
+  assert(m_line_buffer);
+  assert(line);
+
+  size_t lines_allocated = m_height + (m_vertical_padding<<1);
+
+  m_head = (m_head + 1) % lines_allocated;
+  m_vertical_start++;
+
+  T *bottom = m_line_buffer[m_head + lines_allocated - 1] + m_horizontal_padding;
+  std::memmove(bottom, line, m_width * sizeof(T));
+  fillBorder(bottom, m_width, m_horizontal_padding, m_border, m_border_value);
+}
+
+// reads row y into a line of the buffer, only the columns outside the image go through the border policy
+template <typename T>
+void cchunk<T>::loadLine(T *line, const cpixmap<T>& image, int y, size_t z)
+{
+  const int width = (int)(m_width + (m_horizontal_padding<<1));
+  const int image_width = (int)image.getWidth();
+  const T value = (m_border == BORDER_CONSTANT) ? m_border_value : T(0);
+
+  int row = mapBorder(y, (int)image.getHeight(), m_border);
+  if (row < 0) {
+    std::fill(line, line + width, value);
+    return;
+  }
+
+  int begin = std::min(std::max(-m_horizontal_start, 0), width);
+  int end = std::max(std::min(image_width - m_horizontal_start, width), begin);
+  if (begin < end)
+    image.readHLine(line + begin, end - begin, m_horizontal_start + begin, row, z);
+
+  for (int i = 0; i < begin; i++) {
+    int col = mapBorder(m_horizontal_start + i, image_width, m_border);
+    line[i] = (col < 0) ? value : image.getPixel(col, row, z);
+  }
+  for (int i = end; i < width; i++) {
+    int col = mapBorder(m_horizontal_start + i, image_width, m_border);
+    line[i] = (col < 0) ? value : image.getPixel(col, row, z);
   }
 }
 
@@ -170,7 +262,25 @@ T& cchunk<T>::operator()(int y, int x)
   assert(y >= m_vertical_start && y < m_vertical_start + (int)(m_height + (m_vertical_padding<<1)));
   assert(x >= m_horizontal_start && x < m_horizontal_start + (int)(m_width + (m_horizontal_padding<<1)));
     
-  return *(m_line_buffer[y-m_vertical_start] + x-m_horizontal_start);
+  return *(m_line_buffer[m_head + y-m_vertical_start] + x-m_horizontal_start);
+}
+
+// the line of row y, [0] is the pixel at the x origin and [-hpadding] the leftmost padding
+template <typename T>
+inline T *cchunk<T>::getLine(int y)
+{
+  assert(y >= m_vertical_start && y < m_vertical_start + (int)(m_height + (m_vertical_padding<<1)));
+
+  return m_line_buffer[m_head + y-m_vertical_start] + m_horizontal_padding;
+}
+
+// the i-th line from the top of the buffer, including the vertical padding
+template <typename T>
+inline T *cchunk<T>::getBufferLine(size_t i)
+{
+  assert(i < m_height + (m_vertical_padding<<1));
+
+  return m_line_buffer[m_head + i] + m_horizontal_padding;
 }
 
 template <typename T>
@@ -178,8 +288,35 @@ void cchunk<T>::reallocate(size_t lines, size_t stride)
 {
   if (m_buffer) delete [] m_buffer;
   if (m_line_buffer) delete [] m_line_buffer;
-  m_buffer = new uint8_t[lines * stride];
-  m_line_buffer = new T*[lines];
+  m_buffer = new uint8_t[lines * stride + 63];
+  m_aligned_buffer = (uint8_t *)CACHELINE_ALIGN((uintptr_t)m_buffer);
+  m_line_buffer = new T*[lines<<1];
+  for (size_t i = 0; i < lines; i++) {
+    m_line_buffer[i] = (T *)(m_aligned_buffer + i*stride + m_offset) - m_horizontal_padding;
+    m_line_buffer[lines + i] = m_line_buffer[i];
+  }
+  m_head = 0;
+}
+
+// number of horizontal strips a frame is split into, each thread runs its own window over a strip
+inline size_t getStripCount(size_t height)
+{
+#if defined(_OPENMP)
+  size_t strips = (size_t)omp_get_max_threads();
+#else
+  size_t strips = 1;
+#endif
+  return std::max((size_t)1, std::min(strips, height));
+}
+
+// size of the cache a thread keeps its tiles in
+inline size_t getL2CacheSize(void)
+{
+#if defined(_SC_LEVEL2_CACHE_SIZE)
+  long bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  if (bytes > 0) return (size_t)bytes;
+#endif
+  return 256 * 1024; // a common per-core L2
 }
 
 template <typename T>
@@ -197,12 +334,14 @@ public:
   {
     m_base->setDimension(img.getWidth(), lines, hpadding, vpadding);
   }
-  void draftSlice(const cpixmap<T>& img, size_t z = 0) { m_base->draft(img, 0, 0, z); }
+  void setBorder(border_t border, T value = 0) { m_base->setBorder(border, value); }
+  void draftSlice(const cpixmap<T>& img, size_t z = 0, size_t y = 0) { m_base->draft(img, 0, y, z); }
   void shiftSlice(size_t lines_to_read, const cpixmap<T>& img, size_t z = 0)
   {
     m_base->shiftByNextLines(lines_to_read, img, z);
   }
   T& operator()(int y, int x) { return (*m_base)(y, x); }
+  T *getLine(int y) { return m_base->getLine(y); }
 private:
   cchunk<T> *m_base;
 };
@@ -219,9 +358,15 @@ public:
   }
   virtual ~window3x3_frame(void) { delete m_base; }
   void setFrame(const cpixmap<T>& img) { m_base->setDimension(img.getWidth(), 1, 1, 1); }
-  void draftFrame(const cpixmap<T>& img, size_t z = 0) { m_base->draft(img, 0, 0, z); }
+  void setBorder(border_t border, T value = 0) { m_base->setBorder(border, value); }
+  void draftFrame(const cpixmap<T>& img, size_t z = 0, size_t y = 0) { m_base->draft(img, 0, y, z); }
   void shiftFrame(const cpixmap<T>& img, size_t z = 0) { m_base->shiftByNextLines(1, img, z); }
   T& operator() (int y, int x) { return (*m_base)(y, x); }
+  // lines around the center row, [0] is the first pixel and [-1]/[width] the padding
+  T *getLine(int dy) { return m_base->getBufferLine(1 + dy); }
+  T *getPrevLine(void) { return m_base->getBufferLine(0); }
+  T *getCurrLine(void) { return m_base->getBufferLine(1); }
+  T *getNextLine(void) { return m_base->getBufferLine(2); }
 private:
   cchunk<T> *m_base;
 };
@@ -238,9 +383,15 @@ public:
   }
   virtual ~window5x5_frame(void) { delete m_base; }
   void setFrame(const cpixmap<T>& img) { m_base->setDimension(img.getWidth(), 1, 2, 2); }
-  void draftFrame(const cpixmap<T>& img, size_t z = 0) { m_base->draft(img, 0, 0, z); }
+  void setBorder(border_t border, T value = 0) { m_base->setBorder(border, value); }
+  void draftFrame(const cpixmap<T>& img, size_t z = 0, size_t y = 0) { m_base->draft(img, 0, y, z); }
   void shiftFrame(const cpixmap<T>& img, size_t z = 0) { m_base->shiftByNextLines(1, img, z); }
   T& operator() (int y, int x) { return (*m_base)(y, x); }
+  // lines around the center row, [0] is the first pixel and [-2]/[width+1] the padding
+  T *getLine(int dy) { return m_base->getBufferLine(2 + dy); }
+  T *getPrevLine(void) { return m_base->getBufferLine(1); }
+  T *getCurrLine(void) { return m_base->getBufferLine(2); }
+  T *getNextLine(void) { return m_base->getBufferLine(3); }
 private:
   cchunk<T> *m_base;
 };
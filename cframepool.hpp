@@ -0,0 +1,184 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+#include <map>
+#include <vector>
+#include <mutex>
+
+// size class of a frame, frames of the same class share one layout
+typedef struct frame_key {
+  size_t width, height, bands;
+  size_t depth; // sizeof(T)
+  size_t alignment, guard;
+  size_t bytes; // of the allocation, follows from the rest and takes no part in the order
+  bool operator<(const struct frame_key& rhs) const {
+    if (width != rhs.width) return width < rhs.width;
+    if (height != rhs.height) return height < rhs.height;
+    if (bands != rhs.bands) return bands < rhs.bands;
+    if (depth != rhs.depth) return depth < rhs.depth;
+    if (alignment != rhs.alignment) return alignment < rhs.alignment;
+    return guard < rhs.guard;
+  }
+} frame_key_t;
+
+// Keeps released pixmap buffers by size class so that a pipeline producing
+// the same frames over and over stops paying for new, page faults and first touch.
+// Both the frames of a class and the bytes of all classes are capped; over the byte cap
+// the frames of the classes used least recently go first, so sizes that stop coming back
+// do not stay. The pool has to outlive every pixmap drawing from it.
+class cframepool {
+public:
+  cframepool(size_t frames_per_class = 8, size_t max_bytes = (size_t)256 << 20)
+    : m_frames_per_class(frames_per_class), m_max_bytes(max_bytes), m_bytes(0), m_clock(0) {}
+  ~cframepool(void) { clear(); }
+  uint8_t *acquire(const frame_key_t& key);
+  void release(const frame_key_t& key, uint8_t *allocation);
+  void clear(void);
+  size_t getFreeFrames(void);
+  size_t getFreeBytes(void);
+  void setFramesPerClass(size_t frames_per_class);
+  void setMaxBytes(size_t max_bytes);
+  static cframepool& getDefault(void);
+
+private:
+  typedef struct {
+    std::vector<uint8_t *> frames;
+    uint64_t last_use; // m_clock at the last acquire or release of the class
+  } frame_class_t;
+
+  cframepool(const cframepool&);
+  cframepool& operator=(const cframepool&);
+  void evict(size_t bytes, std::vector<uint8_t *>& victims);
+  std::mutex m_mutex;
+  std::map<frame_key_t, frame_class_t> m_free; // only classes holding frames
+  size_t m_frames_per_class; // frames kept beyond this are freed
+  size_t m_max_bytes; // bytes of all the frames kept
+  size_t m_bytes;
+  uint64_t m_clock;
+};
+
+inline uint8_t *cframepool::acquire(const frame_key_t& key)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::map<frame_key_t, frame_class_t>::iterator it = m_free.find(key);
+    if (it != m_free.end()) {
+      uint8_t *allocation = it->second.frames.back();
+      it->second.frames.pop_back();
+      it->second.last_use = ++m_clock;
+      m_bytes -= key.bytes;
+      if (it->second.frames.empty()) m_free.erase(it);
+      return allocation;
+    }
+  }
+  uint8_t *allocation = new uint8_t[key.bytes];
+  assert(allocation);
+  return allocation;
+}
+
+inline void cframepool::release(const frame_key_t& key, uint8_t *allocation)
+{
+  assert(allocation);
+  std::vector<uint8_t *> victims;
+  bool kept = false;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::map<frame_key_t, frame_class_t>::iterator it = m_free.find(key);
+    const size_t frames = (it != m_free.end()) ? it->second.frames.size() : 0;
+    if (frames < m_frames_per_class && key.bytes <= m_max_bytes) {
+      evict(key.bytes, victims);
+      frame_class_t& frame_class = m_free[key];
+      frame_class.frames.push_back(allocation);
+      frame_class.last_use = ++m_clock;
+      m_bytes += key.bytes;
+      kept = true;
+    }
+  }
+  for (size_t i = 0; i < victims.size(); i++)
+    delete [] victims[i];
+  if (!kept) delete [] allocation;
+}
+
+// frees frames of the least recently used classes until bytes more fit under the cap,
+// the caller holds the lock and deletes the victims after letting it go
+inline void cframepool::evict(size_t bytes, std::vector<uint8_t *>& victims)
+{
+  while (m_bytes + bytes > m_max_bytes && !m_free.empty()) {
+    std::map<frame_key_t, frame_class_t>::iterator lru = m_free.begin();
+    for (std::map<frame_key_t, frame_class_t>::iterator it = m_free.begin(); it != m_free.end(); ++it)
+      if (it->second.last_use < lru->second.last_use) lru = it;
+    victims.push_back(lru->second.frames.back());
+    lru->second.frames.pop_back();
+    m_bytes -= lru->first.bytes;
+    if (lru->second.frames.empty()) m_free.erase(lru);
+  }
+}
+
+inline void cframepool::clear(void)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (std::map<frame_key_t, frame_class_t>::iterator it = m_free.begin(); it != m_free.end(); ++it)
+    for (size_t i = 0; i < it->second.frames.size(); i++)
+      delete [] it->second.frames[i];
+  m_free.clear();
+  m_bytes = 0;
+}
+
+inline size_t cframepool::getFreeFrames(void)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  size_t count = 0;
+  for (std::map<frame_key_t, frame_class_t>::iterator it = m_free.begin(); it != m_free.end(); ++it)
+    count += it->second.frames.size();
+  return count;
+}
+
+inline size_t cframepool::getFreeBytes(void)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_bytes;
+}
+
+// frames already kept beyond a lower limit go on their next release
+inline void cframepool::setFramesPerClass(size_t frames_per_class)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_frames_per_class = frames_per_class;
+}
+
+inline void cframepool::setMaxBytes(size_t max_bytes)
+{
+  std::vector<uint8_t *> victims;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_max_bytes = max_bytes;
+    evict(0, victims);
+  }
+  for (size_t i = 0; i < victims.size(); i++)
+    delete [] victims[i];
+}
+
+// process wide pool, never destroyed so that static pixmaps can still return their frames at exit
+inline cframepool& cframepool::getDefault(void)
+{
+  static cframepool *pool = new cframepool();
+  return *pool;
+}
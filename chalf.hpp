@@ -0,0 +1,100 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstring>
+#include <cstdint>
+#include <limits>
+
+// IEEE 754 binary16 bits of a float, rounded to the nearest even like F16C (vcvtps2ph with
+// imm 0) so that the scalar and the SIMD conversions give the same bits
+inline uint16_t getHalfBits(float f)
+{
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  const uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+  x &= 0x7fffffff;
+  if (x >= 0x7f800000) // inf, NaN keeps its upper payload and turns quiet
+    return sign | 0x7c00 | (x > 0x7f800000 ? 0x0200 | (uint16_t)((x >> 13) & 0x03ff) : 0);
+  if (x >= 0x477ff000) return sign | 0x7c00; // from 65520 up rounds to inf
+  if (x < 0x38800000) { // below 2^-14, subnormal in half
+    if (x < 0x33000000) return sign; // up to 2^-25 rounds to zero
+    const uint32_t shift = 126 - (x >> 23), mantissa = (x & 0x007fffff) | 0x00800000;
+    const uint32_t rest = mantissa & ((1u << shift) - 1), tie = 1u << (shift - 1);
+    uint32_t bits = mantissa >> shift;
+    if (rest > tie || (rest == tie && (bits & 1))) ++bits;
+    return sign | (uint16_t)bits;
+  }
+  uint32_t bits = x - 0x38000000; // exponent bias from 127 to 15
+  const uint32_t rest = bits & 0x1fff;
+  bits >>= 13;
+  if (rest > 0x1000 || (rest == 0x1000 && (bits & 1))) ++bits; // a carry moves into the exponent
+  return sign | (uint16_t)bits;
+}
+
+// every half is a float, nothing to round
+inline float getHalfValue(uint16_t h)
+{
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16, exponent = (h >> 10) & 0x1f, mantissa = h & 0x03ff;
+  uint32_t x;
+  if (exponent == 0x1f) x = sign | 0x7f800000 | (mantissa << 13) | (mantissa ? 0x00400000 : 0);
+  else if (exponent) x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  else if (!mantissa) x = sign;
+  else { // subnormal, normalized in float
+    exponent = 113;
+    while (!(mantissa & 0x0400)) mantissa <<= 1, --exponent;
+    x = sign | (exponent << 23) | ((mantissa & 0x03ff) << 13);
+  }
+  float f;
+  std::memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+// Half precision pixels for memory-bound float images: stored in 16 bits, computed in float.
+// The kernels convert whole lines (see convertHalfLine in gaussian_filter.SIMD.hpp), the
+// conversions here are for the scalar code and take the same rounding.
+struct half_t {
+  uint16_t bits;
+
+  half_t(void) {}
+  half_t(float f) : bits(getHalfBits(f)) {}
+  operator float(void) const { return getHalfValue(bits); }
+  static half_t fromBits(uint16_t bits) { half_t h; h.bits = bits; return h; }
+};
+
+// not in the copies gaussian_filter.dispatch.cpp makes inside its namespaces, nor used there
+#if !defined(GAUSSIAN_DISPATCH_NAMESPACE)
+namespace std {
+template <> class numeric_limits<half_t> {
+public:
+  static const bool is_specialized = true;
+  static const bool is_signed = true;
+  static const bool is_integer = false;
+  static const bool is_exact = false;
+  static const bool has_infinity = true;
+  static const bool has_quiet_NaN = true;
+  static const int digits = 11;
+  static const int radix = 2;
+  static half_t min(void) { return half_t::fromBits(0x0400); } // 2^-14
+  static half_t max(void) { return half_t::fromBits(0x7bff); } // 65504
+  static half_t lowest(void) { return half_t::fromBits(0xfbff); }
+  static half_t epsilon(void) { return half_t::fromBits(0x1400); } // 2^-10
+  static half_t infinity(void) { return half_t::fromBits(0x7c00); }
+  static half_t quiet_NaN(void) { return half_t::fromBits(0x7e00); }
+};
+}
+#endif
@@ -0,0 +1,260 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstring>
+#include <cassert>
+#include <cstdint>
+#if defined(__unix__) || defined(__APPLE__)
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# define PIXMAP_HAVE_MMAP 1
+#endif
+
+#include "cpixmap.hpp"
+#include "chalf.hpp"
+
+typedef enum {
+  PIXEL_UNKNOWN = 0,
+  PIXEL_UINT8 = 1,
+  PIXEL_INT8 = 2,
+  PIXEL_UINT16 = 3,
+  PIXEL_INT16 = 4,
+  PIXEL_UINT32 = 5,
+  PIXEL_INT32 = 6,
+  PIXEL_FLOAT = 7,
+  PIXEL_DOUBLE = 8,
+  PIXEL_HALF = 9
+} pixel_type_t;
+
+template <typename T> inline pixel_type_t getPixelType(void) { return PIXEL_UNKNOWN; }
+template <> inline pixel_type_t getPixelType<uint8_t>(void) { return PIXEL_UINT8; }
+template <> inline pixel_type_t getPixelType<int8_t>(void) { return PIXEL_INT8; }
+template <> inline pixel_type_t getPixelType<uint16_t>(void) { return PIXEL_UINT16; }
+template <> inline pixel_type_t getPixelType<int16_t>(void) { return PIXEL_INT16; }
+template <> inline pixel_type_t getPixelType<uint32_t>(void) { return PIXEL_UINT32; }
+template <> inline pixel_type_t getPixelType<int32_t>(void) { return PIXEL_INT32; }
+template <> inline pixel_type_t getPixelType<float>(void) { return PIXEL_FLOAT; }
+template <> inline pixel_type_t getPixelType<double>(void) { return PIXEL_DOUBLE; }
+template <> inline pixel_type_t getPixelType<half_t>(void) { return PIXEL_HALF; }
+
+#define RAW_PIXMAP_MAGIC "GFRAWPIX"
+#define RAW_PIXMAP_VERSION 1
+// pixels start on a page so that every row keeps the alignment of the stride
+#define RAW_PIXMAP_OFFSET 4096
+
+// Header at the start of a raw planar file, in the byte order of the machine that wrote it.
+// Band z, row y starts at offset + z*band_stride + y*stride.
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t type; // pixel_type_t
+  uint64_t width, height, bands;
+  uint64_t stride; // bytes from one row to the next
+  uint64_t band_stride;
+  uint64_t offset; // bytes from the start of the file to the first pixel
+} raw_pixmap_header_t;
+
+typedef enum {
+  ACCESS_NORMAL = 0,
+  ACCESS_SEQUENTIAL = 1, // read ahead aggressively, drop pages behind
+  ACCESS_RANDOM = 2,
+  ACCESS_WILLNEED = 3    // start reading the whole file now
+} access_t;
+
+// A pixmap whose pixels are a mapping of a raw planar file rather than a heap buffer.
+// It is a view as far as cpixmap is concerned, so every kernel taking a cpixmap<T>&
+// runs on it unchanged: reads page-fault in from the file and writes to a writable
+// mapping go straight back into it. The pixels of a read only mapping must not be written.
+// Resizing or realigning it detaches it from the file.
+template <typename T>
+class cmappedpixmap : public cpixmap<T> {
+public:
+  cmappedpixmap(void) : m_mapping(NULL), m_length(0), m_writable(false) {}
+  virtual ~cmappedpixmap(void) { close(); }
+  // maps an existing file of pixels of type T, false if it can not be mapped or is not one
+  bool open(const char *path, bool writable = false);
+  // makes a new file (or truncates one) for w x h x b pixels and maps it writable,
+  // rows are padded to the alignment in bytes
+  bool create(const char *path, size_t w, size_t h, size_t b = 1, size_t alignment = sizeof(T));
+  void close(void);
+  bool isOpen(void) const { return m_mapping != NULL; }
+  bool isWritable(void) const { return m_writable; }
+  void advise(access_t access);
+  // writes the dirty pages back now instead of whenever the kernel decides to
+  bool sync(void);
+
+private:
+  cmappedpixmap(const cmappedpixmap&);
+  cmappedpixmap& operator=(const cmappedpixmap&);
+  bool map(int fd, size_t length, bool writable);
+  static bool isValidHeader(const raw_pixmap_header_t& header, size_t length);
+  void attachHeader(const raw_pixmap_header_t& header);
+  uint8_t *m_mapping;
+  size_t m_length;
+  bool m_writable;
+};
+
+template <typename T>
+bool cmappedpixmap<T>::open(const char *path, bool writable)
+{
+  assert(path);
+  close();
+#if defined(PIXMAP_HAVE_MMAP)
+  int fd = ::open(path, writable ? O_RDWR : O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(raw_pixmap_header_t) || !map(fd, (size_t)st.st_size, writable)) {
+    ::close(fd);
+    return false;
+  }
+  ::close(fd); // the mapping keeps the file
+
+  raw_pixmap_header_t header;
+  memcpy(&header, m_mapping, sizeof(header));
+  if (!isValidHeader(header, m_length)) {
+    close();
+    return false;
+  }
+  attachHeader(header);
+  advise(ACCESS_SEQUENTIAL);
+  return true;
+#else
+  (void)writable;
+  return false;
+#endif
+}
+
+// The header comes from the file, so none of its sizes is trusted: every product is checked
+// by a division before it could wrap, and the rows have to stay aligned for T.
+template <typename T>
+bool cmappedpixmap<T>::isValidHeader(const raw_pixmap_header_t& header, size_t length)
+{
+  if (memcmp(header.magic, RAW_PIXMAP_MAGIC, sizeof(header.magic)) || header.version != RAW_PIXMAP_VERSION ||
+      header.type != (uint32_t)getPixelType<T>() || header.width == 0 || header.height == 0 || header.bands == 0)
+    return false;
+  if (header.offset < sizeof(header) || header.offset > length ||
+      header.offset % sizeof(T) || header.stride % sizeof(T) || header.band_stride % sizeof(T))
+    return false;
+  if (header.width > header.stride / sizeof(T)) return false; // stride < width * sizeof(T)
+  if (header.height > header.band_stride / header.stride) return false; // band_stride < height * stride
+  if (header.bands > (length - header.offset) / header.band_stride) return false; // past the end of the file
+  return true;
+}
+
+template <typename T>
+bool cmappedpixmap<T>::create(const char *path, size_t w, size_t h, size_t b, size_t alignment)
+{
+  assert(path);
+  assert(w > 0 && h > 0 && b > 0);
+  assert(alignment >= sizeof(T) && (alignment & (alignment - 1)) == 0);
+  close();
+#if defined(PIXMAP_HAVE_MMAP)
+  raw_pixmap_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, RAW_PIXMAP_MAGIC, sizeof(header.magic));
+  header.version = RAW_PIXMAP_VERSION;
+  header.type = (uint32_t)getPixelType<T>();
+  header.width = w, header.height = h, header.bands = b;
+  header.stride = ALIGN_TO(w * sizeof(T), alignment);
+  header.band_stride = h * header.stride;
+  header.offset = RAW_PIXMAP_OFFSET;
+  assert(header.type != PIXEL_UNKNOWN);
+
+  int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return false;
+  // the file is sparse until written, so its pages cost nothing before the kernel fills them
+  const size_t length = header.offset + b * header.band_stride;
+  if (ftruncate(fd, (off_t)length) < 0 || !map(fd, length, true)) {
+    ::close(fd);
+    return false;
+  }
+  ::close(fd);
+
+  memcpy(m_mapping, &header, sizeof(header));
+  attachHeader(header);
+  advise(ACCESS_SEQUENTIAL);
+  return true;
+#else
+  (void)h, (void)b;
+  return false;
+#endif
+}
+
+template <typename T>
+bool cmappedpixmap<T>::map(int fd, size_t length, bool writable)
+{
+#if defined(PIXMAP_HAVE_MMAP)
+  void *p = mmap(NULL, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) return false;
+  m_mapping = (uint8_t *)p;
+  m_length = length;
+  m_writable = writable;
+  return true;
+#else
+  (void)fd, (void)length, (void)writable;
+  return false;
+#endif
+}
+
+template <typename T>
+void cmappedpixmap<T>::attachHeader(const raw_pixmap_header_t& header)
+{
+  cpixmap<T>::operator=(cpixmap<T>((T *)(m_mapping + header.offset), header.width, header.height, header.bands,
+				   header.stride, header.band_stride));
+}
+
+template <typename T>
+void cmappedpixmap<T>::close(void)
+{
+  if (!m_mapping) return;
+  cpixmap<T>::operator=(cpixmap<T>());
+#if defined(PIXMAP_HAVE_MMAP)
+  munmap(m_mapping, m_length);
+#endif
+  m_mapping = NULL;
+  m_length = 0;
+  m_writable = false;
+}
+
+template <typename T>
+void cmappedpixmap<T>::advise(access_t access)
+{
+  if (!m_mapping) return;
+#if defined(PIXMAP_HAVE_MMAP)
+  int advice = MADV_NORMAL;
+  if (access == ACCESS_SEQUENTIAL) advice = MADV_SEQUENTIAL;
+  else if (access == ACCESS_RANDOM) advice = MADV_RANDOM;
+  else if (access == ACCESS_WILLNEED) advice = MADV_WILLNEED;
+  madvise(m_mapping, m_length, advice); // only a hint, failing costs nothing
+#else
+  (void)access;
+#endif
+}
+
+template <typename T>
+bool cmappedpixmap<T>::sync(void)
+{
+  if (!m_mapping || !m_writable) return true;
+#if defined(PIXMAP_HAVE_MMAP)
+  return msync(m_mapping, m_length, MS_SYNC) == 0;
+#else
+  return false;
+#endif
+}
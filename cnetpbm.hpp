@@ -0,0 +1,545 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cerrno>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <sys/types.h>
+#if defined(__unix__) || defined(__APPLE__)
+# include <unistd.h>
+# include <sys/stat.h>
+#endif
+
+#include <cpixmap.hpp>
+
+#if defined(USE_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define MAX_VECTOR_SIZE 512
+# include <vectorclass/vectorclass.h>
+# define NETPBM_SIMD 1
+#endif
+
+// Binary PGM (P5), PPM (P6) with 8 or 16 bits per sample, and PFM (Pf, PF).
+// Rows are decoded one at a time straight into band planes, RGB goes to
+// RED_BAND/GREEN_BAND/BLUE_BAND of cpixmap. PFM stores its rows bottom up,
+// the reader and writer seek so that rows always go top down.
+
+inline bool isLittleEndian(void)
+{
+  const uint16_t probe = 1;
+  return *(const uint8_t *)&probe == 1;
+}
+
+inline void swapSampleBytes(uint16_t *samples, size_t len)
+{
+  size_t x = 0;
+#if defined(NETPBM_SIMD)
+  for (; x + 8 <= len; x += 8) {
+    Vec8us v;
+    v.load(&samples[x]);
+    v = (v << 8) | (v >> 8);
+    v.store(&samples[x]);
+  }
+#endif
+  for (; x < len; ++x) samples[x] = (uint16_t)((samples[x] << 8) | (samples[x] >> 8));
+}
+
+inline void swapSampleBytes(float *samples, size_t len)
+{
+  uint8_t *p = (uint8_t *)samples;
+  for (size_t x = 0; x < len; ++x, p += 4) {
+    uint8_t t0 = p[0], t1 = p[1];
+    p[0] = p[3], p[1] = p[2], p[2] = t1, p[3] = t0;
+  }
+}
+
+// splits len interleaved RGB samples into planes
+template <typename S>
+inline void deinterleaveRGB(S *r, S *g, S *b, const S *rgb, size_t len, size_t x = 0)
+{
+  for (; x < len; ++x) {
+    r[x] = rgb[3*x], g[x] = rgb[3*x+1], b[x] = rgb[3*x+2];
+  }
+}
+
+#if defined(NETPBM_SIMD) && INSTRSET >= 5 // lookup16 takes pshufb, which zeroes at index -1, from SSE4.1 on
+// Byte k of sample x of a plane is byte B*(3x+c)+k of the 48 loaded: each of the three
+// vectors is shuffled into the lanes it has a share of and zeroed (index -1) elsewhere.
+// Returns the samples done, the tail is left to the scalar loop.
+template <size_t B>
+inline size_t deinterleaveRGBBytes(uint8_t *r, uint8_t *g, uint8_t *b, const uint8_t *rgb, size_t len)
+{
+  Vec16c index[3][3];
+  for (int c = 0; c < 3; ++c) {
+    for (int s = 0; s < 3; ++s) {
+      int8_t shuffle[16];
+      for (int j = 0; j < 16; ++j) {
+	int from = (int)B * (3*(j/(int)B) + c) + j%(int)B - 16*s;
+	shuffle[j] = (from >= 0 && from < 16) ? (int8_t)from : -1;
+      }
+      index[c][s].load(shuffle);
+    }
+  }
+  uint8_t *planes[3] = { r, g, b };
+
+  const size_t step = 16 / B;
+  size_t x = 0;
+  for (; x + step <= len; x += step) {
+    Vec16c v0, v1, v2;
+    v0.load(&rgb[3*B*x]), v1.load(&rgb[3*B*x+16]), v2.load(&rgb[3*B*x+32]);
+    for (int c = 0; c < 3; ++c)
+      (lookup16(index[c][0], v0) | lookup16(index[c][1], v1) | lookup16(index[c][2], v2)).store(&planes[c][B*x]);
+  }
+  return x;
+}
+
+inline void deinterleaveRGB(uint8_t *r, uint8_t *g, uint8_t *b, const uint8_t *rgb, size_t len)
+{
+  size_t x = deinterleaveRGBBytes<1>(r, g, b, rgb, len);
+  deinterleaveRGB<uint8_t>(r, g, b, rgb, len, x);
+}
+
+inline void deinterleaveRGB(uint16_t *r, uint16_t *g, uint16_t *b, const uint16_t *rgb, size_t len)
+{
+  size_t x = deinterleaveRGBBytes<2>((uint8_t *)r, (uint8_t *)g, (uint8_t *)b, (const uint8_t *)rgb, len);
+  deinterleaveRGB<uint16_t>(r, g, b, rgb, len, x);
+}
+
+inline void deinterleaveRGB(float *r, float *g, float *b, const float *rgb, size_t len)
+{
+  size_t x = deinterleaveRGBBytes<4>((uint8_t *)r, (uint8_t *)g, (uint8_t *)b, (const uint8_t *)rgb, len);
+  deinterleaveRGB<float>(r, g, b, rgb, len, x);
+}
+#endif
+
+// the other way round, for writing
+template <typename S>
+inline void interleaveRGB(S *rgb, const S *r, const S *g, const S *b, size_t len)
+{
+  for (size_t x = 0; x < len; ++x) {
+    rgb[3*x] = r[x], rgb[3*x+1] = g[x], rgb[3*x+2] = b[x];
+  }
+}
+
+// offsets past 2 GiB need the 64-bit seek of the platform
+inline bool seekNetpbm(FILE *file, uint64_t offset)
+{
+#if defined(__unix__) || defined(__APPLE__)
+  return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#else
+  return fseek(file, (long)offset, SEEK_SET) == 0;
+#endif
+}
+
+inline uint64_t tellNetpbm(FILE *file)
+{
+#if defined(__unix__) || defined(__APPLE__)
+  return (uint64_t)ftello(file);
+#else
+  return (uint64_t)ftell(file);
+#endif
+}
+
+// a width or height, digits only and small enough for size_t
+inline bool parseNetpbmSize(const char *token, size_t& value)
+{
+  if (!isdigit((unsigned char)token[0])) return false;
+  char *end;
+  errno = 0;
+  const unsigned long long parsed = strtoull(token, &end, 10);
+  if (*end || errno == ERANGE || parsed > (unsigned long long)std::numeric_limits<size_t>::max()) return false;
+  value = (size_t)parsed;
+  return true;
+}
+
+// the maxval of a PGM or PPM, digits only from 1 to 65535
+inline bool parseNetpbmMaxval(const char *token, unsigned& value)
+{
+  size_t parsed;
+  if (!parseNetpbmSize(token, parsed) || parsed == 0 || parsed > 65535) return false;
+  value = (unsigned)parsed;
+  return true;
+}
+
+// the scale and endianness of a PFM, a finite number other than zero
+inline bool parseNetpbmScale(const char *token, double& value)
+{
+  char *end;
+  value = strtod(token, &end);
+  return end != token && !*end && std::isfinite(value) && value != 0.0;
+}
+
+// bytes of the whole file, the position is left where it was
+inline bool getNetpbmFileSize(FILE *file, uint64_t& size)
+{
+#if defined(__unix__) || defined(__APPLE__)
+  struct stat st;
+  if (fstat(fileno(file), &st) < 0 || st.st_size < 0) return false;
+  size = (uint64_t)st.st_size;
+  return true;
+#else
+  const uint64_t position = tellNetpbm(file);
+  if (fseek(file, 0, SEEK_END) != 0) return false;
+  size = tellNetpbm(file);
+  return seekNetpbm(file, position);
+#endif
+}
+
+// reads at an offset without going through the stdio buffer, which a seek per row would throw away
+inline bool readNetpbmAt(FILE *file, void *buffer, size_t bytes, uint64_t offset)
+{
+#if defined(__unix__) || defined(__APPLE__)
+  return pread(fileno(file), buffer, bytes, (off_t)offset) == (ssize_t)bytes;
+#else
+  return seekNetpbm(file, offset) && fread(buffer, 1, bytes, file) == bytes;
+#endif
+}
+
+class cnetpbmreader {
+public:
+  cnetpbmreader(void) : m_file(NULL) { reset(); }
+  ~cnetpbmreader(void) { close(); }
+  // reads the header, false if the file is not a binary PGM, PPM or PFM
+  bool open(const char *path);
+  void close(void);
+  size_t getWidth(void) const { return m_width; }
+  size_t getHeight(void) const { return m_height; }
+  size_t getBands(void) const { return m_bands; }
+  size_t getDepth(void) const { return m_depth; } // bytes per sample
+  bool isFloat(void) const { return m_float; }
+  unsigned getMaxValue(void) const { return m_maxval; }
+  size_t getRow(void) const { return m_row; } // next row to be read
+  // true when the samples fit in T: 16-bit files need 16 bits, PFM needs floating point
+  template <typename T> bool isReadableAs(void) const;
+  // true when the samples are stored as T, then they go straight to the planes
+  template <typename T> bool isStoredAs(void) const;
+  // the next row from the top into lines[z] for every band, in cpixmap band order
+  template <typename T> bool readRow(T *const *lines);
+  // the rows left into image, resized to the file when it does not match
+  template <typename T> bool read(cpixmap<T>& image);
+
+private:
+  cnetpbmreader(const cnetpbmreader&);
+  cnetpbmreader& operator=(const cnetpbmreader&);
+  void reset(void);
+  bool readHeaderToken(char *token, size_t size);
+  template <typename S, typename T> void decodeRow(const S *samples, T *const *lines);
+  FILE *m_file;
+  size_t m_width, m_height, m_bands, m_depth;
+  bool m_float, m_swap;
+  unsigned m_maxval;
+  uint64_t m_data; // offset of the first sample
+  size_t m_row;
+  std::vector<uint8_t> m_samples; // one row as stored in the file
+};
+
+inline void cnetpbmreader::reset(void)
+{
+  m_width = m_height = m_bands = m_depth = 0;
+  m_float = m_swap = false;
+  m_maxval = 0;
+  m_data = 0;
+  m_row = 0;
+}
+
+inline void cnetpbmreader::close(void)
+{
+  if (m_file) fclose(m_file);
+  m_file = NULL;
+  reset();
+}
+
+// a whitespace separated header field, comments run from # to the end of the line
+inline bool cnetpbmreader::readHeaderToken(char *token, size_t size)
+{
+  int c = fgetc(m_file);
+  for (;;) {
+    while (c != EOF && isspace(c)) c = fgetc(m_file);
+    if (c != '#') break;
+    while (c != EOF && c != '\n' && c != '\r') c = fgetc(m_file);
+  }
+  size_t len = 0;
+  while (c != EOF && !isspace(c) && len + 1 < size) token[len++] = (char)c, c = fgetc(m_file);
+  token[len] = '\0';
+  // a single whitespace ends the last field before the samples, c has consumed it
+  return len > 0 && (c == EOF || isspace(c));
+}
+
+inline bool cnetpbmreader::open(const char *path)
+{
+  assert(path);
+  close();
+  m_file = fopen(path, "rb");
+  if (!m_file) return false;
+  setvbuf(m_file, NULL, _IOFBF, 1<<20);
+
+  char magic[4], width[24], height[24], range[64];
+  if (!readHeaderToken(magic, sizeof(magic)) || !readHeaderToken(width, sizeof(width)) ||
+      !readHeaderToken(height, sizeof(height)) || !readHeaderToken(range, sizeof(range))) {
+    close();
+    return false;
+  }
+  if (!parseNetpbmSize(width, m_width) || !parseNetpbmSize(height, m_height)) {
+    close();
+    return false;
+  }
+  if (!strcmp(magic, "P5") || !strcmp(magic, "P6")) {
+    m_bands = (magic[1] == '5') ? 1 : 3;
+    if (!parseNetpbmMaxval(range, m_maxval)) {
+      close();
+      return false;
+    }
+    m_depth = (m_maxval < 256) ? 1 : 2;
+    m_swap = (m_depth == 2) && isLittleEndian(); // 16-bit samples are big endian
+  } else if (!strcmp(magic, "Pf") || !strcmp(magic, "PF")) {
+    m_bands = (magic[1] == 'f') ? 1 : 3;
+    double scale;
+    if (!parseNetpbmScale(range, scale)) {
+      close();
+      return false;
+    }
+    m_float = true;
+    m_depth = sizeof(float);
+    m_swap = (scale < 0.0) != isLittleEndian(); // a negative scale means little endian
+  } else {
+    close();
+    return false;
+  }
+  // the sizes come from the file: a row has to fit in size_t and every row in the file,
+  // before anything is allocated for them
+  const uint64_t maxWidth = (uint64_t)std::numeric_limits<size_t>::max() / (m_bands * m_depth);
+  m_data = tellNetpbm(m_file);
+  uint64_t size;
+  if (m_width == 0 || m_height == 0 || m_width > maxWidth || !getNetpbmFileSize(m_file, size) || m_data > size ||
+      m_height > (size - m_data) / (m_width * m_bands * m_depth)) {
+    close();
+    return false;
+  }
+  m_samples.resize(m_width * m_bands * m_depth);
+  return true;
+}
+
+template <typename T>
+bool cnetpbmreader::isReadableAs(void) const
+{
+  if (!std::numeric_limits<T>::is_integer) return true;
+  return !m_float && (uint64_t)std::numeric_limits<T>::max() >= (uint64_t)m_maxval;
+}
+
+template <typename T>
+bool cnetpbmreader::isStoredAs(void) const
+{
+  if (sizeof(T) != m_depth) return false;
+  if (m_float) return !std::numeric_limits<T>::is_integer;
+  return std::numeric_limits<T>::is_integer && !std::numeric_limits<T>::is_signed;
+}
+
+template <typename S, typename T>
+void cnetpbmreader::decodeRow(const S *samples, T *const *lines)
+{
+  if (m_bands == 1) {
+    for (size_t x = 0; x < m_width; ++x) lines[0][x] = static_cast<T>(samples[x]);
+    return;
+  }
+  // RGB in the file, blue first in cpixmap
+  for (size_t x = 0; x < m_width; ++x) {
+    lines[cpixmap<T>::RED_BAND][x] = static_cast<T>(samples[3*x]);
+    lines[cpixmap<T>::GREEN_BAND][x] = static_cast<T>(samples[3*x+1]);
+    lines[cpixmap<T>::BLUE_BAND][x] = static_cast<T>(samples[3*x+2]);
+  }
+}
+
+template <typename T>
+bool cnetpbmreader::readRow(T *const *lines)
+{
+  assert(lines);
+  if (!m_file || m_row >= m_height || !isReadableAs<T>()) return false;
+
+  const size_t bytes = m_samples.size();
+  if (m_float) {
+    if (!readNetpbmAt(m_file, &m_samples[0], bytes, m_data + (uint64_t)(m_height-1 - m_row) * bytes)) return false;
+  } else if (fread(&m_samples[0], 1, bytes, m_file) != bytes) return false;
+  m_row++;
+
+  const size_t len = m_width * m_bands;
+  if (m_swap && m_depth == 2) swapSampleBytes((uint16_t *)&m_samples[0], len);
+  else if (m_swap) swapSampleBytes((float *)&m_samples[0], len);
+
+  if (m_bands == 3 && isStoredAs<T>()) {
+    deinterleaveRGB((T *)lines[cpixmap<T>::RED_BAND], (T *)lines[cpixmap<T>::GREEN_BAND],
+		    (T *)lines[cpixmap<T>::BLUE_BAND], (const T *)&m_samples[0], m_width);
+    return true;
+  }
+  if (m_float) decodeRow((const float *)&m_samples[0], lines);
+  else if (m_depth == 2) decodeRow((const uint16_t *)&m_samples[0], lines);
+  else decodeRow((const uint8_t *)&m_samples[0], lines);
+  return true;
+}
+
+template <typename T>
+bool cnetpbmreader::read(cpixmap<T>& image)
+{
+  if (!m_file || !isReadableAs<T>()) return false;
+  if (!image.isMatched(m_width, m_height, m_bands)) image.setResolution(m_width, m_height, m_bands, false);
+
+  std::vector<T *> lines(m_bands);
+  while (m_row < m_height) {
+    for (size_t z = 0; z < m_bands; ++z) lines[z] = image.getLine(m_row, z);
+    if (!readRow(&lines[0])) return false;
+  }
+  return true;
+}
+
+class cnetpbmwriter {
+public:
+  cnetpbmwriter(void) : m_file(NULL) { reset(); }
+  ~cnetpbmwriter(void) { close(); }
+  // writes the header for w x h pixels of 1 or 3 bands, the format follows T:
+  // uint8_t and uint16_t make PGM/PPM with a maxval of 255 and 65535, float makes PFM
+  template <typename T> bool open(const char *path, size_t w, size_t h, size_t b = 1);
+  // false if a row failed to be written or the file could not be flushed
+  bool close(void);
+  size_t getRow(void) const { return m_row; } // next row to be written
+  // the next row from the top out of lines[z] for every band, in cpixmap band order
+  template <typename T> bool writeRow(const T *const *lines);
+  // every row of image, whose size has to be the one given to open
+  template <typename T> bool write(const cpixmap<T>& image);
+
+private:
+  cnetpbmwriter(const cnetpbmwriter&);
+  cnetpbmwriter& operator=(const cnetpbmwriter&);
+  void reset(void);
+  FILE *m_file;
+  size_t m_width, m_height, m_bands, m_depth;
+  bool m_float, m_swap, m_failed;
+  uint64_t m_data;
+  size_t m_row;
+  std::vector<uint8_t> m_samples;
+};
+
+inline void cnetpbmwriter::reset(void)
+{
+  m_width = m_height = m_bands = m_depth = 0;
+  m_float = m_swap = m_failed = false;
+  m_data = 0;
+  m_row = 0;
+}
+
+inline bool cnetpbmwriter::close(void)
+{
+  bool ok = !m_failed;
+  if (m_file) ok = (fclose(m_file) == 0) && ok;
+  m_file = NULL;
+  reset();
+  return ok;
+}
+
+template <typename T>
+bool cnetpbmwriter::open(const char *path, size_t w, size_t h, size_t b)
+{
+  assert(path);
+  assert(w > 0 && h > 0 && (b == 1 || b == 3));
+  close();
+  if (sizeof(T) == 1 && std::numeric_limits<T>::is_integer && !std::numeric_limits<T>::is_signed) m_depth = 1;
+  else if (sizeof(T) == 2 && std::numeric_limits<T>::is_integer && !std::numeric_limits<T>::is_signed) m_depth = 2;
+  else if (sizeof(T) == sizeof(float) && !std::numeric_limits<T>::is_integer) m_depth = 4, m_float = true;
+  else {
+    assert(!"PGM, PPM and PFM hold uint8_t, uint16_t or float");
+    return false;
+  }
+
+  m_file = fopen(path, "wb");
+  if (!m_file) return false;
+  setvbuf(m_file, NULL, _IOFBF, 1<<20);
+
+  m_width = w, m_height = h, m_bands = b;
+  int written;
+  if (m_float) {
+    // PFM in the byte order of this machine
+    written = fprintf(m_file, "P%c\n%zu %zu\n%s\n", (b == 1) ? 'f' : 'F', w, h, isLittleEndian() ? "-1.0" : "1.0");
+  } else {
+    written = fprintf(m_file, "P%c\n%zu %zu\n%u\n", (b == 1) ? '5' : '6', w, h, (m_depth == 1) ? 255u : 65535u);
+    m_swap = (m_depth == 2) && isLittleEndian();
+  }
+  if (written < 0) {
+    close();
+    return false;
+  }
+  m_data = tellNetpbm(m_file);
+  m_samples.resize(w * b * m_depth);
+  return true;
+}
+
+template <typename T>
+bool cnetpbmwriter::writeRow(const T *const *lines)
+{
+  assert(lines);
+  assert(sizeof(T) == m_depth);
+  if (!m_file || m_row >= m_height) return false;
+
+  T *samples = (T *)&m_samples[0];
+  if (m_bands == 1) memcpy(samples, lines[0], m_width * sizeof(T));
+  else interleaveRGB(samples, lines[cpixmap<T>::RED_BAND], lines[cpixmap<T>::GREEN_BAND],
+		     lines[cpixmap<T>::BLUE_BAND], m_width);
+  if (m_swap) swapSampleBytes((uint16_t *)samples, m_width * m_bands);
+
+  const size_t bytes = m_samples.size();
+  if ((m_float && !seekNetpbm(m_file, m_data + (uint64_t)(m_height-1 - m_row) * bytes)) ||
+      fwrite(samples, 1, bytes, m_file) != bytes) {
+    m_failed = true;
+    return false;
+  }
+  m_row++;
+  return true;
+}
+
+template <typename T>
+bool cnetpbmwriter::write(const cpixmap<T>& image)
+{
+  assert(image.getWidth() == m_width && image.getHeight() == m_height && image.getBands() >= m_bands);
+  std::vector<const T *> lines(m_bands);
+  while (m_row < m_height) {
+    for (size_t z = 0; z < m_bands; ++z) lines[z] = image.getLine(m_row, z);
+    if (!writeRow(&lines[0])) return false;
+  }
+  return true;
+}
+
+// whole images in one call
+template <typename T>
+bool readNetpbm(const char *path, cpixmap<T>& image)
+{
+  cnetpbmreader reader;
+  return reader.open(path) && reader.read(image);
+}
+
+template <typename T>
+bool writeNetpbm(const char *path, const cpixmap<T>& image)
+{
+  cnetpbmwriter writer;
+  size_t bands = (image.getBands() >= 3) ? 3 : 1;
+  if (!writer.open<T>(path, image.getWidth(), image.getHeight(), bands)) return false;
+  bool ok = writer.write(image);
+  return writer.close() && ok;
+}
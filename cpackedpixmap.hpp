@@ -0,0 +1,104 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+
+#include "cpixmap.hpp"
+
+// Pixels with their channels next to each other (BGR, BGRA, ...) instead of in planes,
+// the way cameras and encoders hand them over. The samples are kept in a one band
+// cpixmap channels times as wide, which gives the rows, strides, alignment and pools;
+// it is not a cpixmap itself so that the planar kernels can not be handed one by mistake.
+// Channel c of a packed pixel is band c of the planar pixmap (cpixmap<T>::BLUE_BAND, ...).
+template <typename T>
+class cpackedpixmap {
+public:
+  cpackedpixmap(void) : m_width(0), m_channels(0) {}
+  cpackedpixmap(size_t w, size_t h, size_t c) : m_samples(w * c, h, 1), m_width(w), m_channels(c) { assert(c > 0); }
+  // view of packed rows owned by the caller
+  cpackedpixmap(T *buffer, size_t w, size_t h, size_t c, size_t stride)
+    : m_samples(buffer, w * c, h, 1, stride), m_width(w), m_channels(c) { assert(c > 0); }
+  size_t getWidth(void) const { return m_width; }
+  size_t getHeight(void) const { return m_samples.getHeight(); }
+  size_t getChannels(void) const { return m_channels; }
+  size_t getStride(void) const { return m_samples.getStride(); }
+  // the samples of row y, pixel x starts at [x*channels]
+  T *getLine(size_t y) const { return m_samples.getLine(y); }
+  T& getPixel(size_t x, size_t y, size_t c = 0) const { return m_samples.getLine(y)[x*m_channels + c]; }
+  cpixmap<T>& getSamples(void) { return m_samples; }
+  const cpixmap<T>& getSamples(void) const { return m_samples; }
+  void setResolution(size_t w, size_t h, size_t c, bool clear = true);
+  bool isMatched(const cpackedpixmap& pixmap) const;
+
+private:
+  cpixmap<T> m_samples;
+  size_t m_width;
+  size_t m_channels;
+};
+
+template <typename T>
+void cpackedpixmap<T>::setResolution(size_t w, size_t h, size_t c, bool clear)
+{
+  assert(c > 0);
+  m_samples.setResolution(w * c, h, 1, clear);
+  m_width = w;
+  m_channels = c;
+}
+
+template <typename T>
+bool cpackedpixmap<T>::isMatched(const cpackedpixmap& pixmap) const
+{
+  return m_width == pixmap.m_width && getHeight() == pixmap.getHeight() && m_channels == pixmap.m_channels;
+}
+
+// planar bands into packed channels, dst takes the size of src
+template <typename T>
+void packPixmap(cpackedpixmap<T>& dst, const cpixmap<T>& src)
+{
+  const size_t width = src.getWidth(), channels = src.getBands();
+  if (dst.getWidth() != width || dst.getHeight() != src.getHeight() || dst.getChannels() != channels)
+    dst.setResolution(width, src.getHeight(), channels, false);
+
+#pragma omp parallel for
+  for (size_t y = 0; y < src.getHeight(); ++y) {
+    T *line = dst.getLine(y);
+    for (size_t z = 0; z < channels; ++z) {
+      const T *band = src.getLine(y, z);
+      for (size_t x = 0; x < width; ++x) line[x*channels + z] = band[x];
+    }
+  }
+}
+
+// packed channels into planar bands, dst takes the size of src
+template <typename T>
+void unpackPixmap(cpixmap<T>& dst, const cpackedpixmap<T>& src)
+{
+  const size_t width = src.getWidth(), channels = src.getChannels();
+  if (!dst.isMatched(width, src.getHeight(), channels))
+    dst.setResolution(width, src.getHeight(), channels, false);
+
+#pragma omp parallel for
+  for (size_t y = 0; y < src.getHeight(); ++y) {
+    const T *line = src.getLine(y);
+    for (size_t z = 0; z < channels; ++z) {
+      T *band = dst.getLine(y, z);
+      for (size_t x = 0; x < width; ++x) band[x] = line[x*channels + z];
+    }
+  }
+}
@@ -25,8 +25,13 @@
 #include <cstdint>
 
 #include "cregion.hpp"
+#include "cframepool.hpp"
 
 #define QWORD_ALIGN(bytes) (((bytes) + 7) & -8)
+#define ALIGN_TO(bytes, alignment) (((bytes) + (alignment) - 1) & ~((alignment) - 1))
+
+// rows start on cache lines unless told otherwise
+#define PIXMAP_DEFAULT_ALIGNMENT 64
 
 template <typename T>
 class cpixmap : public cregion<size_t> {
@@ -34,14 +39,29 @@ class cpixmap : public cregion<size_t> {
 public:
   cpixmap(void);
   cpixmap(size_t w, size_t h, size_t b = 1);
+  cpixmap(size_t w, size_t h, size_t b, size_t alignment, size_t guard = 0);
   cpixmap(const cpixmap& pixmap);
+  cpixmap(cpixmap&& pixmap);
   cpixmap(const cregion& dim);
+  cpixmap(const cregion& dim, cframepool& pool, bool clear = true);
+  // views, the pixels stay owned by the caller or by the parent pixmap
+  cpixmap(T *buffer, size_t w, size_t h, size_t b, size_t stride, size_t band_stride = 0);
+  cpixmap(const cpixmap& parent, const cregion& roi);
   virtual ~cpixmap(void);
   T *getImage(size_t z = 0) const;
   T *getLine(size_t y, size_t z = 0) const;
   T& getPixel(size_t x, size_t y, size_t z = 0) const;
   void putPixel(T val, size_t x, size_t y, size_t z = 0);
-  void setResolution(size_t w, size_t h, size_t b = 1);
+  // clear = false leaves the pixels as they are for callers that overwrite every one of them
+  void setResolution(size_t w, size_t h, size_t b = 1, bool clear = true);
+  void setAlignment(size_t alignment, size_t guard = 0);
+  size_t getAlignment(void) const { return m_alignment; }
+  size_t getGuard(void) const { return m_guard; }
+  size_t getStride(void) const { return m_height_stride; }
+  size_t getBandStride(void) const { return m_band_stride; }
+  bool isView(void) const { return m_buffer && !m_allocation; }
+  void setPool(cframepool *pool) { m_pool = pool; }
+  cframepool *getPool(void) const { return m_pool; }
   bool isMatched(const cpixmap& pixmap) const;
   bool isMatched(const cregion& a) const;
   bool isMatched(size_t w, size_t h, size_t b = 1) const;
@@ -51,7 +71,9 @@ public:
   void flipVertically(void);
   void lshiftPixel(size_t bits = 1);
   void rshiftPixel(size_t bits = 1);
-  //  cpixmap<T> operator=(const cpixmap<T>& m);
+  cpixmap<T>& operator=(const cpixmap<T>& rhs);
+  cpixmap<T>& operator=(cpixmap<T>&& rhs);
+  cpixmap<T> clone(void) const;
   T& operator() (size_t z, size_t y, size_t x) { return *(T *)(m_buffer + z*m_band_stride + y*m_height_stride + x*sizeof(T)); }
   T& operator() (size_t y, size_t x) { return *(T *)(m_buffer + y*m_height_stride + x*sizeof(T)); }
 
@@ -64,69 +86,223 @@ public:
   
 private:
   //void reallocate(size_t w, size_t h);
-  void reallocate(size_t w, size_t h, size_t b = 0);
+  void reallocate(size_t w, size_t h, size_t b = 0, bool clear = true);
+  void freeAllocation(void);
+  void attach(uint8_t *buffer, size_t stride, size_t band_stride);
+  void copyPixels(const cpixmap& pixmap);
+  void release(void);
   size_t m_height_stride;
   size_t m_band_stride;
+  size_t m_alignment; // bytes, every row starts on it
+  size_t m_guard; // bytes kept free on the left and right of every row
+  uint8_t *m_allocation; // NULL for views
   uint8_t *m_buffer;
+  cframepool *m_pool; // NULL allocates with new
+  frame_key_t m_key; // layout of m_allocation
 };
 
 template <typename T> 
 cpixmap<T>::cpixmap(void)
-  : m_height_stride(0), m_band_stride(0), m_buffer(NULL) {}
+  : m_height_stride(0), m_band_stride(0),
+    m_alignment(PIXMAP_DEFAULT_ALIGNMENT), m_guard(0), m_allocation(NULL), m_buffer(NULL), m_pool(NULL), m_key() {}
 
 template <typename T>
 cpixmap<T>::cpixmap(size_t w, size_t h, size_t b)
-  : cregion(w, h, b), m_height_stride(0), m_band_stride(0), m_buffer(NULL)
+  : cregion(w, h, b), m_height_stride(0), m_band_stride(0),
+    m_alignment(PIXMAP_DEFAULT_ALIGNMENT), m_guard(0), m_allocation(NULL), m_buffer(NULL), m_pool(NULL), m_key()
 {
   //setResolution(w, h, b);
   reallocate(w, h, b);
 }
 
+template <typename T>
+cpixmap<T>::cpixmap(size_t w, size_t h, size_t b, size_t alignment, size_t guard)
+  : cregion(w, h, b), m_height_stride(0), m_band_stride(0),
+    m_alignment(alignment), m_guard(guard), m_allocation(NULL), m_buffer(NULL), m_pool(NULL), m_key()
+{
+  assert(alignment >= sizeof(T) && (alignment & (alignment - 1)) == 0);
+  reallocate(w, h, b);
+}
+
+// deep copy, a copy of a view owns its pixels
 template <typename T>
 cpixmap<T>::cpixmap(const cpixmap& pixmap)
-  : m_height_stride(0), m_band_stride(0), m_buffer(NULL)
+  : cregion(pixmap), m_height_stride(0), m_band_stride(0),
+    m_alignment(pixmap.isView() ? PIXMAP_DEFAULT_ALIGNMENT : pixmap.m_alignment), m_guard(pixmap.m_guard),
+    m_allocation(NULL), m_buffer(NULL), m_pool(pixmap.m_pool), m_key()
 {
-  const cregion dim = static_cast<const cregion>(pixmap);
-  setResolution(dim.getWidth(), dim.getHeight(), dim.getBands());
+  reallocate(m_width, m_height, m_bands, false);
+  copyPixels(pixmap);
+}
+
+template <typename T>
+cpixmap<T>::cpixmap(cpixmap&& pixmap)
+  : cregion(pixmap), m_height_stride(pixmap.m_height_stride), m_band_stride(pixmap.m_band_stride),
+    m_alignment(pixmap.m_alignment), m_guard(pixmap.m_guard),
+    m_allocation(pixmap.m_allocation), m_buffer(pixmap.m_buffer), m_pool(pixmap.m_pool), m_key(pixmap.m_key)
+{
+  pixmap.m_allocation = NULL;
+  pixmap.release();
 }
   
 template <typename T>
 cpixmap<T>::cpixmap(const cregion& dim)
-  : m_height_stride(0), m_band_stride(0), m_buffer(NULL)
+  : m_height_stride(0), m_band_stride(0),
+    m_alignment(PIXMAP_DEFAULT_ALIGNMENT), m_guard(0), m_allocation(NULL), m_buffer(NULL), m_pool(NULL), m_key()
 {
   setResolution(dim.getWidth(), dim.getHeight(), dim.getBands());
 }
 
+template <typename T>
+cpixmap<T>::cpixmap(const cregion& dim, cframepool& pool, bool clear)
+  : cregion(dim.getWidth(), dim.getHeight(), dim.getBands()), m_height_stride(0), m_band_stride(0),
+    m_alignment(PIXMAP_DEFAULT_ALIGNMENT), m_guard(0), m_allocation(NULL), m_buffer(NULL), m_pool(&pool), m_key()
+{
+  reallocate(m_width, m_height, m_bands, clear);
+}
+
+template <typename T>
+cpixmap<T>::cpixmap(T *buffer, size_t w, size_t h, size_t b, size_t stride, size_t band_stride)
+  : cregion(w, h, b), m_height_stride(0), m_band_stride(0),
+    m_alignment(PIXMAP_DEFAULT_ALIGNMENT), m_guard(0), m_allocation(NULL), m_buffer(NULL), m_pool(NULL), m_key()
+{
+  assert(buffer);
+  assert(stride >= w * sizeof(T));
+  attach((uint8_t *)buffer, stride, band_stride ? band_stride : h * stride);
+}
+
+// roi is given in the coordinates of parent, the view itself starts at the origin
+template <typename T>
+cpixmap<T>::cpixmap(const cpixmap& parent, const cregion& roi)
+  : cregion(roi.getWidth(), roi.getHeight(), roi.getBands()), m_height_stride(0), m_band_stride(0),
+    m_alignment(PIXMAP_DEFAULT_ALIGNMENT), m_guard(0), m_allocation(NULL), m_buffer(NULL), m_pool(NULL), m_key()
+{
+  assert(roi.getXEnd() <= parent.getWidth());
+  assert(roi.getYEnd() <= parent.getHeight());
+  assert(roi.getZEnd() <= parent.getBands());
+  attach((uint8_t *)(parent.getLine(roi.getYOrigin(), roi.getZOrigin()) + roi.getXOrigin()),
+	 parent.m_height_stride, parent.m_band_stride);
+}
+
 template <typename T>
 cpixmap<T>::~cpixmap(void)
 {
   //std::cout << static_cast<void *>(this) << " paraent" <<std::endl;
   //std::cout << static_cast<void *>(m_buffer) << " is freed!" << std::endl;
-  if (m_buffer) delete [] reinterpret_cast<double *>(m_buffer);
+  release();
+}
+
+template <typename T>
+void cpixmap<T>::release(void)
+{
+  freeAllocation();
   m_buffer = NULL;
+  m_height_stride = m_band_stride = 0;
+  cregion::setResolution(0, 0, 0);
 }
 
+// the pixels are copied into the existing buffer when the sizes match, so assigning to a view writes through it
 template <typename T>
-void cpixmap<T>::setResolution(size_t w, size_t h, size_t b)
+cpixmap<T>& cpixmap<T>::operator=(const cpixmap<T>& rhs)
+{
+  if (this == &rhs) return *this;
+  if (m_width != rhs.m_width || m_height != rhs.m_height || m_bands != rhs.m_bands) {
+    if (isView()) m_alignment = PIXMAP_DEFAULT_ALIGNMENT;
+    setResolution(rhs.m_width, rhs.m_height, rhs.m_bands, false);
+  }
+  copyPixels(rhs);
+  return *this;
+}
+
+template <typename T>
+cpixmap<T>& cpixmap<T>::operator=(cpixmap<T>&& rhs)
+{
+  if (this == &rhs) return *this;
+  release();
+  cregion::operator=(rhs);
+  m_height_stride = rhs.m_height_stride, m_band_stride = rhs.m_band_stride;
+  m_alignment = rhs.m_alignment, m_guard = rhs.m_guard;
+  m_allocation = rhs.m_allocation, m_buffer = rhs.m_buffer;
+  m_pool = rhs.m_pool, m_key = rhs.m_key;
+  rhs.m_allocation = NULL;
+  rhs.release();
+  return *this;
+}
+
+template <typename T>
+cpixmap<T> cpixmap<T>::clone(void) const
+{
+  return cpixmap<T>(*this);
+}
+
+template <typename T>
+void cpixmap<T>::copyPixels(const cpixmap& pixmap)
+{
+  assert(m_width == pixmap.m_width && m_height == pixmap.m_height && m_bands == pixmap.m_bands);
+  for (size_t z = 0; z < m_bands; z++)
+    for (size_t y = 0; y < m_height; y++)
+      memmove(getLine(y, z), pixmap.getLine(y, z), m_width * sizeof(T)); // views may overlap
+}
+
+template <typename T>
+void cpixmap<T>::setResolution(size_t w, size_t h, size_t b, bool clear)
 {
   cregion::setResolution(w, h, b);
-  reallocate(w, h, b);
+  reallocate(w, h, b, clear);
+}
+
+template <typename T>
+void cpixmap<T>::attach(uint8_t *buffer, size_t stride, size_t band_stride)
+{
+  m_height_stride = stride;
+  m_band_stride = band_stride;
+  m_buffer = buffer;
+  // the best alignment every row of the external buffer shares
+  while (m_alignment > sizeof(T) && (((uintptr_t)buffer | stride | band_stride) & (m_alignment - 1)))
+    m_alignment >>= 1;
+}
+
+// changes the row layout, the pixels are reallocated and cleared
+template <typename T>
+void cpixmap<T>::setAlignment(size_t alignment, size_t guard)
+{
+  assert(alignment >= sizeof(T) && (alignment & (alignment - 1)) == 0);
+  m_alignment = alignment;
+  m_guard = guard;
+  reallocate(m_width, m_height, m_bands);
+}
+
+template <typename T>
+void cpixmap<T>::freeAllocation(void)
+{
+  if (!m_allocation) return;
+  if (m_pool) m_pool->release(m_key, m_allocation);
+  else delete [] m_allocation;
+  m_allocation = NULL;
 }
 
 template <typename T>
-void cpixmap<T>::reallocate(size_t w, size_t h, size_t b)
+void cpixmap<T>::reallocate(size_t w, size_t h, size_t b, bool clear)
 {
   size_t bytes;
 
-  m_height_stride = QWORD_ALIGN(w * sizeof(T)); //+ 7) & -8; // 8 bytes alignment
+  // [guard|pixels|guard] rounded up to the alignment, the left guard keeps the first pixel aligned
+  size_t lead = ALIGN_TO(m_guard, m_alignment);
+  m_height_stride = ALIGN_TO(lead + w * sizeof(T) + m_guard, m_alignment);
   m_band_stride = h * m_height_stride;
   
   bytes = b * m_band_stride;
 
-  if (m_buffer) delete (double *)m_buffer;
-  m_buffer = reinterpret_cast<uint8_t *>(new double[(bytes + 7) / 8]);
-  assert(m_buffer);
-  memset(m_buffer, 0, bytes);
+  // a view resized or realigned detaches from the external pixels
+  freeAllocation();
+  frame_key_t key = { w, h, b, sizeof(T), m_alignment, m_guard, bytes + m_alignment };
+  m_key = key;
+  if (m_pool) m_allocation = m_pool->acquire(m_key);
+  else m_allocation = new uint8_t[m_key.bytes];
+  assert(m_allocation);
+  uint8_t *base = (uint8_t *)ALIGN_TO((uintptr_t)m_allocation, (uintptr_t)m_alignment);
+  if (clear) memset(base, 0, bytes);
+  m_buffer = base + lead;
   //std::cout << static_cast<void *>(this) << " paraent" <<std::endl;
   //std::cout << bytes << " bytes are allocated at " << static_cast<void *>(m_buffer) << std::endl;
 }
@@ -20,8 +20,14 @@
 #include <iostream>
 #include <cstring>
 #include <cstdint>
+#include <vector>
+#include <algorithm>
 
 #include <cpixmap.hpp>
+#include <cpackedpixmap.hpp>
+#include <chalf.hpp>
+#include <cchunk.hpp>
+#include "gaussian_filter.direction.hpp"
 
 #if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
 # define MAX_VECTOR_SIZE 512
@@ -35,354 +41,709 @@
 # error "Undefined SIMD!"
 #endif
 
-inline void blurGaussian3x3Kernel(cpixmap<uint8_t>& dst, cpixmap<uint8_t>& src)
+// gaussian_filter.dispatch.cpp includes this header once per instruction set, each time
+// inside a namespace of its own
+#if defined(GAUSSIAN_DISPATCH_NAMESPACE) && defined(VCL_NAMESPACE)
+using namespace VCL_NAMESPACE;
+#endif
+
+// Lines step by n lanes. A line of len >= n pixels that is not a multiple of n ends on one
+// more full vector at len - n, overlapping the one before it, rather than on a scalar tail:
+// the lanes are recomputed from the same inputs, so only lines shorter than n are left to
+// the scalar code. None of the outputs alias an input, which comes from a window frame.
+inline size_t getVectorEnd(size_t len, size_t n) { return (len < n) ? 0 : len; }
+inline size_t getNextVector(size_t x, size_t n, size_t len) { return (x + (n<<1) <= len || x + n >= len) ? x + n : len - n; }
+
+// vertical 1-2-1 sums of three lines, widened to 16 bits
+inline void sumVertical121(uint16_t *vsum, const uint8_t *prev, const uint8_t *curr, const uint8_t *next, size_t len)
 {
-  assert(dst.getWidth() == src.getWidth());
-  assert(dst.getHeight() == src.getHeight());
-  assert(dst.getBands() >= src.getBands());
+  size_t vecEnd = 0;
+#if defined(__x86_64__) || defined(__i386__)
+# if INSTRSET >= 8 // AVXx - 256bits
+  vecEnd = getVectorEnd(len, 32);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 32, len)) {
+    Vec32uc nnVec, ooVec, ssVec;
+    nnVec.load(&prev[x]), ooVec.load(&curr[x]), ssVec.load(&next[x]);
+    Vec16us loVec = extend_low(nnVec) + (extend_low(ooVec)<<1) + extend_low(ssVec);
+    Vec16us hiVec = extend_high(nnVec) + (extend_high(ooVec)<<1) + extend_high(ssVec);
+    loVec.store(&vsum[x]), hiVec.store(&vsum[x+16]);
+  }
+# elif INSTRSET >= 2 // SSE2 - 128bits
+  vecEnd = getVectorEnd(len, 16);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 16, len)) {
+    Vec16uc nnVec, ooVec, ssVec;
+    nnVec.load(&prev[x]), ooVec.load(&curr[x]), ssVec.load(&next[x]);
+    Vec8us loVec = extend_low(nnVec) + (extend_low(ooVec)<<1) + extend_low(ssVec);
+    Vec8us hiVec = extend_high(nnVec) + (extend_high(ooVec)<<1) + extend_high(ssVec);
+    loVec.store(&vsum[x]), hiVec.store(&vsum[x+8]);
+  }
+# endif
+#elif defined(__ARM_NEON__)
+  vecEnd = getVectorEnd(len, 16);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 16, len)) {
+    uint8x16_t nnVec = vld1q_u8(&prev[x]);
+    uint8x16_t ooVec = vld1q_u8(&curr[x]);
+    uint8x16_t ssVec = vld1q_u8(&next[x]);
+    uint16x8_t loVec = vaddl_u8(vget_low_u8(nnVec), vget_low_u8(ssVec));
+    loVec = vaddq_u16(loVec, vshll_n_u8(vget_low_u8(ooVec), 1));
+    uint16x8_t hiVec = vaddl_u8(vget_high_u8(nnVec), vget_high_u8(ssVec));
+    hiVec = vaddq_u16(hiVec, vshll_n_u8(vget_high_u8(ooVec), 1));
+    vst1q_u16(&vsum[x], loVec), vst1q_u16(&vsum[x+8], hiVec);
+  }
+#endif
+  for (size_t x = vecEnd; x < len; ++x)
+    vsum[x] = (uint16_t)prev[x] + ((uint16_t)curr[x]<<1) + (uint16_t)next[x];
+}
 
-  for (size_t z = 0; z < src.getBands(); ++z) {
-    window3x3_frame<uint8_t> win3x3(src);
-    win3x3.draftFrame(src, z);
-    
-    for (size_t y = 0; y < src.getHeight(); y++) {
-      uint8_t *dstLine = dst.getLine(y, z);
-      uint8_t *prevLine = win3x3.getPrevLine();
-      uint8_t *currLine = win3x3.getCurrLine();
-      uint8_t *nextLine = win3x3.getNextLine();
-
-      /*
-      nwVec|nnVec|neVec
-      -----+-----+-----
-      wwVec|ooVec|eeVec
-      -----+-----+-----
-      swVec|ssVec|seVec
-      */
-#pragma omp parallel for
+// horizontal 1-2-1 sums of the vertical sums, rounded once: (sum + 8) >> 4;
+// the neighbours are step sums away, the channel count of packed pixels
+inline void roundHorizontal121(uint8_t *dst, const uint16_t *vsum, size_t len, size_t step = 1)
+{
+  size_t vecEnd = 0;
 #if defined(__x86_64__) || defined(__i386__)
 # if INSTRSET >= 8 // AVXx - 256bits
-      for (size_t x = 0; x < src.getWidth(); x += 32) {
-	Vec32uc nwVec, nnVec, neVec;
-	nwVec.load(&prevLine[(int)x-1]), nnVec.load(&prevLine[(int)x+0]), neVec.load(&prevLine[(int)x+1]);
-	Vec32uc wwVec, ooVec, eeVec;
-	wwVec.load(&currLine[(int)x-1]), ooVec.load(&currLine[(int)x+0]), eeVec.load(&currLine[(int)x+0]);
-	Vec32uc swVec, ssVec, seVec;
-	swVec.load(&nextLine[(int)x-1]), ssVec.load(&nextLine[(int)x+0]), seVec.load(&nextLine[(int)x+1]);
-	Vec32uc dstVec =
-	  (nwVec>>4) + (nnVec>>3) + (neVec>>4) +
-	  (wwVec>>3) + (ooVec>>2) + (eeVec>>3) +
-	  (swVec>>4) + (ssVec>>3) + (seVec>>4);
-	dstVec.store(&dstLine[x]);
-      }
+  vecEnd = getVectorEnd(len, 32);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 32, len)) {
+    Vec16us wwVec, ooVec, eeVec;
+    wwVec.load(&vsum[x] - step), ooVec.load(&vsum[x]), eeVec.load(&vsum[x] + step);
+    Vec16us loVec = (wwVec + (ooVec<<1) + eeVec + 8) >> 4;
+    wwVec.load(&vsum[x+16] - step), ooVec.load(&vsum[x+16]), eeVec.load(&vsum[x+16] + step);
+    Vec16us hiVec = (wwVec + (ooVec<<1) + eeVec + 8) >> 4;
+    compress(loVec, hiVec).store(&dst[x]);
+  }
 # elif INSTRSET >= 2 // SSE2 - 128bits
-      for (size_t x = 0; x < src.getWidth(); x += 16) {
-	Vec16uc nwVec, nnVec, neVec;
-	nwVec.load(&prevLine[(int)x-1]), nnVec.load(&prevLine[(int)x+0]), neVec.load(&prevLine[(int)x+1]);
-	Vec16uc wwVec, ooVec, eeVec;
-	wwVec.load(&currLine[(int)x-1]), ooVec.load(&currLine[(int)x+0]), eeVec.load(&currLine[(int)x+0]);
-	Vec16uc swVec, ssVec, seVec;
-	swVec.load(&nextLine[(int)x-1]), ssVec.load(&nextLine[(int)x+0]), seVec.load(&nextLine[(int)x+1]);
-	Vec16uc dstVec =
-	  (nwVec>>4) + (nnVec>>3) + (neVec>>4) +
-	  (wwVec>>3) + (ooVec>>2) + (eeVec>>3) +
-	  (swVec>>4) + (ssVec>>3) + (seVec>>4);
-	dstVec.store(&dstLine[x]);
-      }
+  vecEnd = getVectorEnd(len, 16);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 16, len)) {
+    Vec8us wwVec, ooVec, eeVec;
+    wwVec.load(&vsum[x] - step), ooVec.load(&vsum[x]), eeVec.load(&vsum[x] + step);
+    Vec8us loVec = (wwVec + (ooVec<<1) + eeVec + 8) >> 4;
+    wwVec.load(&vsum[x+8] - step), ooVec.load(&vsum[x+8]), eeVec.load(&vsum[x+8] + step);
+    Vec8us hiVec = (wwVec + (ooVec<<1) + eeVec + 8) >> 4;
+    compress(loVec, hiVec).store(&dst[x]);
+  }
 # endif
 #elif defined(__ARM_NEON__)
-      for (size_t x = 0; x < src.getWidth(); x += 16) {
-	uint8x16_t nwVec, nnVec, neVec;
-	nwVec = vld1q_u8((const uint8_t *)&prevLine[(int)x-1]);
-	nnVec = vld1q_u8((const uint8_t *)&prevLine[(int)x+0]);
-	neVec = vld1q_u8((const uint8_t *)&prevLine[(int)x+1]);
-	uint8x16_t wwVec, ooVec, eeVec;
-	wwVec = vld1q_u8((const uint8_t *)&currLine[(int)x-1]);
-	ooVec = vld1q_u8((const uint8_t *)&currLine[(int)x+0]);
-	eeVec = vld1q_u8((const uint8_t *)&currLine[(int)x+1]);
-	uint8x16_t swVec, ssVec, seVec;
-	swVec = vld1q_u8((const uint8_t *)&nextLine[(int)x-1]);
-	ssVec = vld1q_u8((const uint8_t *)&nextLine[(int)x+0]);
-	seVec = vld1q_u8((const uint8_t *)&nextLine[(int)x+1]);
-	
-	uint8x16_t sumVec;
-	sumVec = vdupq_n_u8((uint8_t)0);
-	sumVec = vsra_n_u8(sumVec, nwVec, 4);
-	sumVec = vsra_n_u8(sumVec, nnVec, 3);
-	sumVec = vsra_n_u8(sumVec, neVec, 4);
-	sumVec = vsra_n_u8(sumVec, wwVec, 3);
-	sumVec = vsra_n_u8(sumVec, ooVec, 2);
-	sumVec = vsra_n_u8(sumVec, eeVec, 3);
-	sumVec = vsra_n_u8(sumVec, swVec, 4);
-	sumVec = vsra_n_u8(sumVec, ssVec, 3);
-	sumVec = vsra_n_u8(sumVec, seVec, 4);
-	vst1q_u8((uint8_t *)&dstLine[x], sumVec);
-      }
+  vecEnd = getVectorEnd(len, 16);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 16, len)) {
+    uint16x8_t loVec = vaddq_u16(vld1q_u16(&vsum[x] - step), vld1q_u16(&vsum[x] + step));
+    loVec = vaddq_u16(loVec, vshlq_n_u16(vld1q_u16(&vsum[x]), 1));
+    uint16x8_t hiVec = vaddq_u16(vld1q_u16(&vsum[x+8] - step), vld1q_u16(&vsum[x+8] + step));
+    hiVec = vaddq_u16(hiVec, vshlq_n_u16(vld1q_u16(&vsum[x+8]), 1));
+    vst1q_u8(&dst[x], vcombine_u8(vqrshrn_n_u16(loVec, 4), vqrshrn_n_u16(hiVec, 4)));
+  }
 #endif
-      win3x3.shiftFrame(src, z);
-    }
+  for (size_t x = vecEnd; x < len; ++x)
+    dst[x] = (uint8_t)((*(&vsum[x] - step) + (vsum[x]<<1) + vsum[x+step] + 8) >> 4);
+}
+
+// vertical 1-2-1 sums of three lines, widened to 32 bits
+inline void sumVertical121(uint32_t *vsum, const uint16_t *prev, const uint16_t *curr, const uint16_t *next, size_t len)
+{
+  size_t vecEnd = 0;
+#if defined(__x86_64__) || defined(__i386__)
+# if INSTRSET >= 9 // AVX512 - 512bits
+  vecEnd = getVectorEnd(len, 16);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 16, len)) {
+    Vec16us nnVec, ooVec, ssVec;
+    nnVec.load(&prev[x]), ooVec.load(&curr[x]), ssVec.load(&next[x]);
+    Vec16ui sumVec = extend_to_int(nnVec) + (extend_to_int(ooVec)<<1) + extend_to_int(ssVec);
+    sumVec.store(&vsum[x]);
+  }
+# elif INSTRSET >= 8 // AVX2 - 256bits
+  vecEnd = getVectorEnd(len, 16);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 16, len)) {
+    Vec16us nnVec, ooVec, ssVec;
+    nnVec.load(&prev[x]), ooVec.load(&curr[x]), ssVec.load(&next[x]);
+    Vec8ui loVec = extend_low(nnVec) + (extend_low(ooVec)<<1) + extend_low(ssVec);
+    Vec8ui hiVec = extend_high(nnVec) + (extend_high(ooVec)<<1) + extend_high(ssVec);
+    loVec.store(&vsum[x]), hiVec.store(&vsum[x+8]);
+  }
+# elif INSTRSET >= 2 // SSE2 - 128bits
+  vecEnd = getVectorEnd(len, 8);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 8, len)) {
+    Vec8us nnVec, ooVec, ssVec;
+    nnVec.load(&prev[x]), ooVec.load(&curr[x]), ssVec.load(&next[x]);
+    Vec4ui loVec = extend_low(nnVec) + (extend_low(ooVec)<<1) + extend_low(ssVec);
+    Vec4ui hiVec = extend_high(nnVec) + (extend_high(ooVec)<<1) + extend_high(ssVec);
+    loVec.store(&vsum[x]), hiVec.store(&vsum[x+4]);
+  }
+# endif
+#elif defined(__ARM_NEON__)
+  vecEnd = getVectorEnd(len, 8);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 8, len)) {
+    uint16x8_t nnVec = vld1q_u16(&prev[x]);
+    uint16x8_t ooVec = vld1q_u16(&curr[x]);
+    uint16x8_t ssVec = vld1q_u16(&next[x]);
+    uint32x4_t loVec = vaddl_u16(vget_low_u16(nnVec), vget_low_u16(ssVec));
+    loVec = vaddq_u32(loVec, vshll_n_u16(vget_low_u16(ooVec), 1));
+    uint32x4_t hiVec = vaddl_u16(vget_high_u16(nnVec), vget_high_u16(ssVec));
+    hiVec = vaddq_u32(hiVec, vshll_n_u16(vget_high_u16(ooVec), 1));
+    vst1q_u32(&vsum[x], loVec), vst1q_u32(&vsum[x+4], hiVec);
   }
+#endif
+  for (size_t x = vecEnd; x < len; ++x)
+    vsum[x] = (uint32_t)prev[x] + ((uint32_t)curr[x]<<1) + (uint32_t)next[x];
 }
 
-inline void blurGaussian3x3Kernel(cpixmap<int8_t>& dst, cpixmap<int8_t>& src)
+// horizontal 1-2-1 sums of the vertical sums, rounded once: (sum + 8) >> 4
+inline void roundHorizontal121(uint16_t *dst, const uint32_t *vsum, size_t len, size_t step = 1)
+{
+  size_t vecEnd = 0;
+#if defined(__x86_64__) || defined(__i386__)
+# if INSTRSET >= 9 // AVX512 - 512bits
+  vecEnd = getVectorEnd(len, 16);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 16, len)) {
+    Vec16ui wwVec, ooVec, eeVec;
+    wwVec.load(&vsum[x] - step), ooVec.load(&vsum[x]), eeVec.load(&vsum[x] + step);
+    Vec16ui sumVec = (wwVec + (ooVec<<1) + eeVec + 8) >> 4;
+    compress_to_int16_saturated(sumVec).store(&dst[x]);
+  }
+# elif INSTRSET >= 8 // AVX2 - 256bits
+  vecEnd = getVectorEnd(len, 16);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 16, len)) {
+    Vec8ui wwVec, ooVec, eeVec;
+    wwVec.load(&vsum[x] - step), ooVec.load(&vsum[x]), eeVec.load(&vsum[x] + step);
+    Vec8ui loVec = (wwVec + (ooVec<<1) + eeVec + 8) >> 4;
+    wwVec.load(&vsum[x+8] - step), ooVec.load(&vsum[x+8]), eeVec.load(&vsum[x+8] + step);
+    Vec8ui hiVec = (wwVec + (ooVec<<1) + eeVec + 8) >> 4;
+    compress(loVec, hiVec).store(&dst[x]);
+  }
+# elif INSTRSET >= 2 // SSE2 - 128bits
+  vecEnd = getVectorEnd(len, 8);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 8, len)) {
+    Vec4ui wwVec, ooVec, eeVec;
+    wwVec.load(&vsum[x] - step), ooVec.load(&vsum[x]), eeVec.load(&vsum[x] + step);
+    Vec4ui loVec = (wwVec + (ooVec<<1) + eeVec + 8) >> 4;
+    wwVec.load(&vsum[x+4] - step), ooVec.load(&vsum[x+4]), eeVec.load(&vsum[x+4] + step);
+    Vec4ui hiVec = (wwVec + (ooVec<<1) + eeVec + 8) >> 4;
+    compress(loVec, hiVec).store(&dst[x]);
+  }
+# endif
+#elif defined(__ARM_NEON__)
+  vecEnd = getVectorEnd(len, 8);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 8, len)) {
+    uint32x4_t loVec = vaddq_u32(vld1q_u32(&vsum[x] - step), vld1q_u32(&vsum[x] + step));
+    loVec = vaddq_u32(loVec, vshlq_n_u32(vld1q_u32(&vsum[x]), 1));
+    uint32x4_t hiVec = vaddq_u32(vld1q_u32(&vsum[x+4] - step), vld1q_u32(&vsum[x+4] + step));
+    hiVec = vaddq_u32(hiVec, vshlq_n_u32(vld1q_u32(&vsum[x+4]), 1));
+    vst1q_u16(&dst[x], vcombine_u16(vqrshrn_n_u32(loVec, 4), vqrshrn_n_u32(hiVec, 4)));
+  }
+#endif
+  for (size_t x = vecEnd; x < len; ++x)
+    dst[x] = (uint16_t)((*(&vsum[x] - step) + (vsum[x]<<1) + vsum[x+step] + 8) >> 4);
+}
+
+// floating point sums in the order of getGaussian3x3 (gaussian_filter.hpp), (a + b) + 2*o with the product fused:
+// doubling is exact, so the lanes, the tails and the reference agree to the bit
+#if defined(__x86_64__) || defined(__i386__)
+template <typename V, typename T>
+inline size_t sumVerticalLanes121(T *vsum, const T *prev, const T *curr, const T *next, size_t len)
+{
+  const size_t vecEnd = getVectorEnd(len, V::size());
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, V::size(), len)) {
+    V nnVec, ooVec, ssVec;
+    nnVec.load(&prev[x]), ooVec.load(&curr[x]), ssVec.load(&next[x]);
+    mul_add(ooVec, V(T(2)), nnVec + ssVec).store(&vsum[x]);
+  }
+  return vecEnd;
+}
+
+template <typename V, typename T>
+inline size_t weighHorizontalLanes121(T *dst, const T *vsum, size_t len, size_t step)
+{
+  const size_t vecEnd = getVectorEnd(len, V::size());
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, V::size(), len)) {
+    V wwVec, ooVec, eeVec;
+    wwVec.load(&vsum[x] - step), ooVec.load(&vsum[x]), eeVec.load(&vsum[x] + step);
+    (mul_add(ooVec, V(T(2)), wwVec + eeVec) * V(T(0.0625))).store(&dst[x]);
+  }
+  return vecEnd;
+}
+#endif
+
+inline void sumVertical121(float *vsum, const float *prev, const float *curr, const float *next, size_t len)
+{
+  size_t vecEnd = 0;
+#if defined(__x86_64__) || defined(__i386__)
+# if INSTRSET >= 9 // AVX512 - 512bits
+  vecEnd = sumVerticalLanes121<Vec16f>(vsum, prev, curr, next, len);
+# elif INSTRSET >= 7 // AVX - 256bits
+  vecEnd = sumVerticalLanes121<Vec8f>(vsum, prev, curr, next, len);
+# elif INSTRSET >= 2 // SSE2 - 128bits
+  vecEnd = sumVerticalLanes121<Vec4f>(vsum, prev, curr, next, len);
+# endif
+#elif defined(__ARM_NEON__)
+  vecEnd = getVectorEnd(len, 4);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 4, len)) {
+    float32x4_t ooVec = vld1q_f32(&curr[x]);
+    vst1q_f32(&vsum[x], vaddq_f32(vaddq_f32(vld1q_f32(&prev[x]), vld1q_f32(&next[x])), vaddq_f32(ooVec, ooVec)));
+  }
+#endif
+  for (size_t x = vecEnd; x < len; ++x)
+    vsum[x] = (prev[x] + next[x]) + 2.0f*curr[x];
+}
+
+// horizontal 1-2-1 sums of the vertical sums times 1/16, nothing to round
+inline void roundHorizontal121(float *dst, const float *vsum, size_t len, size_t step = 1)
+{
+  size_t vecEnd = 0;
+#if defined(__x86_64__) || defined(__i386__)
+# if INSTRSET >= 9 // AVX512 - 512bits
+  vecEnd = weighHorizontalLanes121<Vec16f>(dst, vsum, len, step);
+# elif INSTRSET >= 7 // AVX - 256bits
+  vecEnd = weighHorizontalLanes121<Vec8f>(dst, vsum, len, step);
+# elif INSTRSET >= 2 // SSE2 - 128bits
+  vecEnd = weighHorizontalLanes121<Vec4f>(dst, vsum, len, step);
+# endif
+#elif defined(__ARM_NEON__)
+  vecEnd = getVectorEnd(len, 4);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 4, len)) {
+    float32x4_t ooVec = vld1q_f32(&vsum[x]);
+    float32x4_t sumVec = vaddq_f32(vaddq_f32(vld1q_f32(&vsum[x] - step), vld1q_f32(&vsum[x] + step)), vaddq_f32(ooVec, ooVec));
+    vst1q_f32(&dst[x], vmulq_n_f32(sumVec, 0.0625f));
+  }
+#endif
+  for (size_t x = vecEnd; x < len; ++x)
+    dst[x] = ((*(&vsum[x] - step) + vsum[x+step]) + 2.0f*vsum[x]) * 0.0625f;
+}
+
+inline void sumVertical121(double *vsum, const double *prev, const double *curr, const double *next, size_t len)
+{
+  size_t vecEnd = 0;
+#if defined(__x86_64__) || defined(__i386__)
+# if INSTRSET >= 9 // AVX512 - 512bits
+  vecEnd = sumVerticalLanes121<Vec8d>(vsum, prev, curr, next, len);
+# elif INSTRSET >= 7 // AVX - 256bits
+  vecEnd = sumVerticalLanes121<Vec4d>(vsum, prev, curr, next, len);
+# elif INSTRSET >= 2 // SSE2 - 128bits
+  vecEnd = sumVerticalLanes121<Vec2d>(vsum, prev, curr, next, len);
+# endif
+#endif
+  for (size_t x = vecEnd; x < len; ++x)
+    vsum[x] = (prev[x] + next[x]) + 2.0*curr[x];
+}
+
+inline void roundHorizontal121(double *dst, const double *vsum, size_t len, size_t step = 1)
+{
+  size_t vecEnd = 0;
+#if defined(__x86_64__) || defined(__i386__)
+# if INSTRSET >= 9 // AVX512 - 512bits
+  vecEnd = weighHorizontalLanes121<Vec8d>(dst, vsum, len, step);
+# elif INSTRSET >= 7 // AVX - 256bits
+  vecEnd = weighHorizontalLanes121<Vec4d>(dst, vsum, len, step);
+# elif INSTRSET >= 2 // SSE2 - 128bits
+  vecEnd = weighHorizontalLanes121<Vec2d>(dst, vsum, len, step);
+# endif
+#endif
+  for (size_t x = vecEnd; x < len; ++x)
+    dst[x] = ((*(&vsum[x] - step) + vsum[x+step]) + 2.0*vsum[x]) * 0.0625;
+}
+
+// vertical 1-2-1 sums of the lines in S first, then the horizontal sums of them
+template <typename T, typename S>
+inline void blurGaussian3x3Sums(cpixmap<T>& dst, cpixmap<T>& src)
 {
   assert(dst.getWidth() == src.getWidth());
   assert(dst.getHeight() == src.getHeight());
   assert(dst.getBands() >= src.getBands());
 
+  const size_t strips = getStripCount(src.getHeight());
+
   for (size_t z = 0; z < src.getBands(); ++z) {
-    window3x3_frame<int8_t> win3x3(src);
-    win3x3.draftFrame(src, z);
-    
-    for (size_t y = 0; y < src.getHeight(); y++) {
-      int8_t *dstLine = dst.getLine(y, z);
-      int8_t *prevLine = win3x3.getPrevLine();
-      int8_t *currLine = win3x3.getCurrLine();
-      int8_t *nextLine = win3x3.getNextLine();
-
-      /*
-      nwVec|nnVec|neVec
-      -----+-----+-----
-      wwVec|ooVec|eeVec
-      -----+-----+-----
-      swVec|ssVec|seVec
-      */
 #pragma omp parallel for
-#if defined(__x86_64__) || defined(__i386__)
-# if INSTRSET >= 8 // AVXx - 256bits
-      for (size_t x = 0; x < src.getWidth(); x += 32) {
-	Vec32c nwVec, nnVec, neVec;
-	nwVec.load(&prevLine[(int)x-1]), nnVec.load(&prevLine[(int)x+0]), neVec.load(&prevLine[(int)x+1]);
-	Vec32c wwVec, ooVec, eeVec;
-	wwVec.load(&currLine[(int)x-1]), ooVec.load(&currLine[(int)x+0]), eeVec.load(&currLine[(int)x+0]);
-	Vec32c swVec, ssVec, seVec;
-	swVec.load(&nextLine[(int)x-1]), ssVec.load(&nextLine[(int)x+0]), seVec.load(&nextLine[(int)x+1]);
-	Vec32c dstVec =
-	  (nwVec>>4) + (nnVec>>3) + (neVec>>4) +
-	  (wwVec>>3) + (ooVec>>2) + (eeVec>>3) +
-	  (swVec>>4) + (ssVec>>3) + (seVec>>4);
-	dstVec.store(&dstLine[x]);
-      }
-# elif INSTRSET >= 2 // SSE2 - 128bits
-      for (size_t x = 0; x < src.getWidth(); x += 16) {
-	Vec16c nwVec, nnVec, neVec;
-	nwVec.load(&prevLine[(int)x-1]), nnVec.load(&prevLine[(int)x+0]), neVec.load(&prevLine[(int)x+1]);
-	Vec16c wwVec, ooVec, eeVec;
-	wwVec.load(&currLine[(int)x-1]), ooVec.load(&currLine[(int)x+0]), eeVec.load(&currLine[(int)x+0]);
-	Vec16c swVec, ssVec, seVec;
-	swVec.load(&nextLine[(int)x-1]), ssVec.load(&nextLine[(int)x+0]), seVec.load(&nextLine[(int)x+1]);
-	Vec16c dstVec =
-	  (nwVec>>4) + (nnVec>>3) + (neVec>>4) +
-	  (wwVec>>3) + (ooVec>>2) + (eeVec>>3) +
-	  (swVec>>4) + (ssVec>>3) + (seVec>>4);
-	dstVec.store(&dstLine[x]);
+    for (size_t s = 0; s < strips; ++s) {
+      const size_t yBegin = src.getHeight() * s / strips;
+      const size_t yEnd = src.getHeight() * (s+1) / strips;
+      window3x3_frame<T> win3x3(src);
+      win3x3.draftFrame(src, z, yBegin);
+
+      // vertical sums of the columns from -1 to width
+      std::vector<S> vsumBuffer(src.getWidth() + 2);
+      S *vsum = &vsumBuffer[1];
+    
+      for (size_t y = yBegin; y < yEnd; y++) {
+	T *dstLine = dst.getLine(y, z);
+	T *prevLine = win3x3.getPrevLine();
+	T *currLine = win3x3.getCurrLine();
+	T *nextLine = win3x3.getNextLine();
+
+	sumVertical121(vsum-1, prevLine-1, currLine-1, nextLine-1, src.getWidth()+2);
+	roundHorizontal121(dstLine, vsum, src.getWidth());
+
+	win3x3.shiftFrame(src, z);
       }
+    }
+  }
+}
+
+// exact 1-2-1 weights in 16-bit lanes, rounded once
+inline void blurGaussian3x3Kernel(cpixmap<uint8_t>& dst, cpixmap<uint8_t>& src)
+{
+  blurGaussian3x3Sums<uint8_t, uint16_t>(dst, src);
+}
+
+// exact 1-2-1 weights in 32-bit lanes, rounded once
+inline void blurGaussian3x3Kernel(cpixmap<uint16_t>& dst, cpixmap<uint16_t>& src)
+{
+  blurGaussian3x3Sums<uint16_t, uint32_t>(dst, src);
+}
+
+// weights of 1/16, 2/16 and 4/16 in the type itself
+inline void blurGaussian3x3Kernel(cpixmap<float>& dst, cpixmap<float>& src)
+{
+  blurGaussian3x3Sums<float, float>(dst, src);
+}
+
+inline void blurGaussian3x3Kernel(cpixmap<double>& dst, cpixmap<double>& src)
+{
+  blurGaussian3x3Sums<double, double>(dst, src);
+}
+
+// half lines to float and back with F16C where the build has it (-mf16c, the AVX2 and AVX-512
+// objects of the dispatcher), with the conversions of chalf.hpp otherwise; both round alike
+inline void convertHalfLine(float *dst, const half_t *src, size_t len)
+{
+  size_t vecEnd = 0;
+#if defined(__F16C__)
+# if INSTRSET >= 9 // AVX512 - 512bits
+  vecEnd = getVectorEnd(len, 16);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 16, len))
+    _mm512_storeu_ps(&dst[x], _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)&src[x])));
+# else
+  vecEnd = getVectorEnd(len, 8);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 8, len))
+    _mm256_storeu_ps(&dst[x], _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)&src[x])));
 # endif
-#elif defined(__ARM_NEON__)
-      for (size_t x = 0; x < src.getWidth(); x += 16) {
-	int8x16_t nwVec, nnVec, neVec;
-	nwVec = vld1q_s8((const int8_t *)&prevLine[(int)x-1]);
-	nnVec = vld1q_s8((const int8_t *)&prevLine[(int)x+0]);
-	neVec = vld1q_s8((const int8_t *)&prevLine[(int)x+1]);
-	int8x16_t wwVec, ooVec, eeVec;
-	wwVec = vld1q_s8((const int8_t *)&currLine[(int)x-1]);
-	ooVec = vld1q_s8((const int8_t *)&currLine[(int)x+0]);
-	eeVec = vld1q_s8((const int8_t *)&currLine[(int)x+1]);
-	int8x16_t swVec, ssVec, seVec;
-	swVec = vld1q_s8((const int8_t *)&nextLine[(int)x-1]);
-	ssVec = vld1q_s8((const int8_t *)&nextLine[(int)x+0]);
-	seVec = vld1q_s8((const int8_t *)&nextLine[(int)x+1]);
-	
-	int8x16_t sumVec;
-	sumVec = vdupq_n_s8((int8_t)0);
-	sumVec = vsra_n_s8(sumVec, nwVec, 4);
-	sumVec = vsra_n_s8(sumVec, nnVec, 3);
-	sumVec = vsra_n_s8(sumVec, neVec, 4);
-	sumVec = vsra_n_s8(sumVec, wwVec, 3);
-	sumVec = vsra_n_s8(sumVec, ooVec, 2);
-	sumVec = vsra_n_s8(sumVec, eeVec, 3);
-	sumVec = vsra_n_s8(sumVec, swVec, 4);
-	sumVec = vsra_n_s8(sumVec, ssVec, 3);
-	sumVec = vsra_n_s8(sumVec, seVec, 4);
-	vst1q_s8((int8_t *)&dstLine[x], sumVec);
-      }
 #endif
-      win3x3.shiftFrame(src, z);
+  for (size_t x = vecEnd; x < len; ++x)
+    dst[x] = (float)src[x];
+}
+
+inline void convertFloatLine(half_t *dst, const float *src, size_t len)
+{
+  size_t vecEnd = 0;
+#if defined(__F16C__)
+# if INSTRSET >= 9 // AVX512 - 512bits
+  vecEnd = getVectorEnd(len, 16);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 16, len))
+    _mm256_storeu_si256((__m256i *)&dst[x], _mm512_cvtps_ph(_mm512_loadu_ps(&src[x]), _MM_FROUND_TO_NEAREST_INT));
+# else
+  vecEnd = getVectorEnd(len, 8);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, 8, len))
+    _mm_storeu_si128((__m128i *)&dst[x], _mm256_cvtps_ph(_mm256_loadu_ps(&src[x]), _MM_FROUND_TO_NEAREST_INT));
+# endif
+#endif
+  for (size_t x = vecEnd; x < len; ++x)
+    dst[x] = half_t(src[x]);
+}
+
+// a half line in float with the border pixel replicated at [-1] and [len]
+inline void loadHalfLine(float *line, const half_t *src, size_t len)
+{
+  convertHalfLine(line, src, len);
+  line[-1] = line[0], line[len] = line[len-1];
+}
+
+// half pixels through the float sums, every line is converted once into a ring of three
+// and the output on its way back: the image moves in 16 bits, the math stays in float
+inline void blurGaussian3x3Kernel(cpixmap<half_t>& dst, cpixmap<half_t>& src)
+{
+  assert(dst.getWidth() == src.getWidth());
+  assert(dst.getHeight() == src.getHeight());
+  assert(dst.getBands() >= src.getBands());
+
+  const size_t width = src.getWidth();
+  const int height = (int)src.getHeight();
+  const size_t strips = getStripCount(src.getHeight());
+
+  for (size_t z = 0; z < src.getBands(); ++z) {
+#pragma omp parallel for
+    for (size_t s = 0; s < strips; ++s) {
+      const int yBegin = (int)(src.getHeight() * s / strips);
+      const int yEnd = (int)(src.getHeight() * (s+1) / strips);
+
+      // lines y-1 to y+1 and the vertical sums of the columns from -1 to width, then the output
+      std::vector<float> buffer(4*(width + 2) + width);
+      float *lines[3] = { &buffer[1], &buffer[width + 3], &buffer[2*width + 5] };
+      float *vsum = &buffer[3*width + 7];
+      float *out = &buffer[4*width + 8];
+      loadHalfLine(lines[1], src.getLine(std::max(yBegin-1, 0), z), width);
+      loadHalfLine(lines[2], src.getLine(yBegin, z), width);
+
+      for (int y = yBegin; y < yEnd; ++y) {
+	float *line = lines[0];
+	lines[0] = lines[1], lines[1] = lines[2], lines[2] = line;
+	loadHalfLine(lines[2], src.getLine(std::min(y+1, height-1), z), width);
+
+	sumVertical121(vsum-1, lines[0]-1, lines[1]-1, lines[2]-1, width+2);
+	roundHorizontal121(out, vsum, width);
+	convertFloatLine(dst.getLine(y, z), out, width);
+      }
     }
   }
 }
 
-inline void blurGaussian3x3Kernel(cpixmap<uint16_t>& dst, cpixmap<uint16_t>& src)
+// 3x3 weights as a shift of each neighbour before the sum, for the types that are not widened:
+// the lanes and the scalar tails share the expression so that both give the same bits
+template <typename V>
+inline V sumShifted3x3(const V& nw, const V& nn, const V& ne, const V& ww, const V& oo, const V& ee,
+		       const V& sw, const V& ss, const V& se)
+{
+  return (nw>>4) + (nn>>3) + (ne>>4) + (ww>>3) + (oo>>2) + (ee>>3) + (sw>>4) + (ss>>3) + (se>>4);
+}
+
+template <typename T>
+inline T blurShifted3x3(const T *prev, const T *curr, const T *next, int x)
+{
+  return sumShifted3x3<T>(prev[x-1], prev[x], prev[x+1], curr[x-1], curr[x], curr[x+1], next[x-1], next[x], next[x+1]);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+  nwVec|nnVec|neVec
+  -----+-----+-----
+  wwVec|ooVec|eeVec
+  -----+-----+-----
+  swVec|ssVec|seVec
+*/
+// vectorized blurShifted3x3, returns where the scalar tail starts
+template <typename V, typename T>
+inline size_t blurShiftedLanes3x3(T *dst, const T *prev, const T *curr, const T *next, size_t len)
+{
+  const size_t vecEnd = getVectorEnd(len, V::size());
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, V::size(), len)) {
+    V nwVec, nnVec, neVec, wwVec, ooVec, eeVec, swVec, ssVec, seVec;
+    nwVec.load(&prev[(int)x-1]), nnVec.load(&prev[x]), neVec.load(&prev[x+1]);
+    wwVec.load(&curr[(int)x-1]), ooVec.load(&curr[x]), eeVec.load(&curr[x+1]);
+    swVec.load(&next[(int)x-1]), ssVec.load(&next[x]), seVec.load(&next[x+1]);
+    sumShifted3x3(nwVec, nnVec, neVec, wwVec, ooVec, eeVec, swVec, ssVec, seVec).store(&dst[x]);
+  }
+  return vecEnd;
+}
+
+// the first n lanes, the others are zero when loaded and left alone when stored
+# if defined(__AVX512BW__) && defined(__AVX512VL__)
+inline void loadPartialLanes(Vec32c& v, const int8_t *p, size_t n) { v = _mm256_maskz_loadu_epi8((__mmask32)(((uint64_t)1<<n) - 1), p); }
+inline void loadPartialLanes(Vec16s& v, const int16_t *p, size_t n) { v = _mm256_maskz_loadu_epi16((__mmask16)((1u<<n) - 1), p); }
+inline void storePartialLanes(int8_t *p, const Vec32c& v, size_t n) { _mm256_mask_storeu_epi8(p, (__mmask32)(((uint64_t)1<<n) - 1), v); }
+inline void storePartialLanes(int16_t *p, const Vec16s& v, size_t n) { _mm256_mask_storeu_epi16(p, (__mmask16)((1u<<n) - 1), v); }
+# endif
+# if INSTRSET >= 9
+inline void loadPartialLanes(Vec16i& v, const int32_t *p, size_t n) { v.load_partial((int)n, p); }
+inline void loadPartialLanes(Vec16ui& v, const uint32_t *p, size_t n) { v.load_partial((int)n, p); }
+inline void storePartialLanes(int32_t *p, const Vec16i& v, size_t n) { v.store_partial((int)n, p); }
+inline void storePartialLanes(uint32_t *p, const Vec16ui& v, size_t n) { v.store_partial((int)n, p); }
+# endif
+
+// blurShiftedLanes3x3 with the end of the line in masked lanes instead, so nothing is left
+// to the scalar code and no load goes past the padding of the frame
+template <typename V, typename T>
+inline size_t blurShiftedMaskedLanes3x3(T *dst, const T *prev, const T *curr, const T *next, size_t len)
+{
+  const size_t x = len - len % V::size();
+  blurShiftedLanes3x3<V>(dst, prev, curr, next, x);
+  if (x < len) {
+    const size_t n = len - x;
+    V nwVec, nnVec, neVec, wwVec, ooVec, eeVec, swVec, ssVec, seVec;
+    loadPartialLanes(nwVec, &prev[(int)x-1], n), loadPartialLanes(nnVec, &prev[x], n), loadPartialLanes(neVec, &prev[x+1], n);
+    loadPartialLanes(wwVec, &curr[(int)x-1], n), loadPartialLanes(ooVec, &curr[x], n), loadPartialLanes(eeVec, &curr[x+1], n);
+    loadPartialLanes(swVec, &next[(int)x-1], n), loadPartialLanes(ssVec, &next[x], n), loadPartialLanes(seVec, &next[x+1], n);
+    storePartialLanes(&dst[x], sumShifted3x3(nwVec, nnVec, neVec, wwVec, ooVec, eeVec, swVec, ssVec, seVec), n);
+  }
+  return len;
+}
+#endif
+
+inline void blurGaussian3x3Kernel(cpixmap<int8_t>& dst, cpixmap<int8_t>& src)
 {
   assert(dst.getWidth() == src.getWidth());
   assert(dst.getHeight() == src.getHeight());
   assert(dst.getBands() >= src.getBands());
 
+  const size_t width = src.getWidth();
+  const size_t strips = getStripCount(src.getHeight());
+
   for (size_t z = 0; z < src.getBands(); ++z) {
-    window3x3_frame<uint16_t> win3x3(src);
-    win3x3.draftFrame(src, z);
-    
-    for (size_t y = 0; y < src.getHeight(); y++) {
-      uint16_t *dstLine = dst.getLine(y, z);
-      uint16_t *prevLine = win3x3.getPrevLine();
-      uint16_t *currLine = win3x3.getCurrLine();
-      uint16_t *nextLine = win3x3.getNextLine();
-
-      /*
-      nwVec|nnVec|neVec
-      -----+-----+-----
-      wwVec|ooVec|eeVec
-      -----+-----+-----
-      swVec|ssVec|seVec
-      */
 #pragma omp parallel for
+    for (size_t s = 0; s < strips; ++s) {
+      const size_t yBegin = src.getHeight() * s / strips;
+      const size_t yEnd = src.getHeight() * (s+1) / strips;
+      window3x3_frame<int8_t> win3x3(src);
+      win3x3.draftFrame(src, z, yBegin);
+    
+      for (size_t y = yBegin; y < yEnd; y++) {
+	int8_t *dstLine = dst.getLine(y, z);
+	int8_t *prevLine = win3x3.getPrevLine();
+	int8_t *currLine = win3x3.getCurrLine();
+	int8_t *nextLine = win3x3.getNextLine();
+
+	size_t vecEnd = 0;
 #if defined(__x86_64__) || defined(__i386__)
-# if INSTRSET >= 8 // AVXx - 256bits
-      for (size_t x = 0; x < src.getWidth(); x += 16) {
-	Vec16us nwVec, nnVec, neVec;
-	nwVec.load(&prevLine[(int)x-1]), nnVec.load(&prevLine[(int)x+0]), neVec.load(&prevLine[(int)x+1]);
-	Vec16us wwVec, ooVec, eeVec;
-	wwVec.load(&currLine[(int)x-1]), ooVec.load(&currLine[(int)x+0]), eeVec.load(&currLine[(int)x+0]);
-	Vec16us swVec, ssVec, seVec;
-	swVec.load(&nextLine[(int)x-1]), ssVec.load(&nextLine[(int)x+0]), seVec.load(&nextLine[(int)x+1]);
-	Vec16us dstVec =
-	  (nwVec>>4) + (nnVec>>3) + (neVec>>4) +
-	  (wwVec>>3) + (ooVec>>2) + (eeVec>>3) +
-	  (swVec>>4) + (ssVec>>3) + (seVec>>4);
-	dstVec.store(&dstLine[x]);
-      }
+# if INSTRSET >= 8 && defined(__AVX512BW__) && defined(__AVX512VL__) // AVX512 - 256bits, masked tails
+	vecEnd = blurShiftedMaskedLanes3x3<Vec32c>(dstLine, prevLine, currLine, nextLine, width);
+# elif INSTRSET >= 8 // AVXx - 256bits
+	vecEnd = blurShiftedLanes3x3<Vec32c>(dstLine, prevLine, currLine, nextLine, width);
 # elif INSTRSET >= 2 // SSE2 - 128bits
-      for (size_t x = 0; x < src.getWidth(); x += 8) {
-	Vec8us nwVec, nnVec, neVec;
-	nwVec.load(&prevLine[(int)x-1]), nnVec.load(&prevLine[(int)x+0]), neVec.load(&prevLine[(int)x+1]);
-	Vec8us wwVec, ooVec, eeVec;
-	wwVec.load(&currLine[(int)x-1]), ooVec.load(&currLine[(int)x+0]), eeVec.load(&currLine[(int)x+0]);
-	Vec8us swVec, ssVec, seVec;
-	swVec.load(&nextLine[(int)x-1]), ssVec.load(&nextLine[(int)x+0]), seVec.load(&nextLine[(int)x+1]);
-	Vec8us dstVec =
-	  (nwVec>>4) + (nnVec>>3) + (neVec>>4) +
-	  (wwVec>>3) + (ooVec>>2) + (eeVec>>3) +
-	  (swVec>>4) + (ssVec>>3) + (seVec>>4);
-	dstVec.store(&dstLine[x]);
-      }
+	vecEnd = blurShiftedLanes3x3<Vec16c>(dstLine, prevLine, currLine, nextLine, width);
 # endif
 #elif defined(__ARM_NEON__)
-      for (size_t x = 0; x < src.getWidth(); x += 8) {
-	uint16x8_t nwVec, nnVec, neVec;
-	nwVec = vld1q_u16((const uint16_t *)&prevLine[(int)x-1]);
-	nnVec = vld1q_u16((const uint16_t *)&prevLine[(int)x+0]);
-	neVec = vld1q_u16((const uint16_t *)&prevLine[(int)x+1]);
-	uint16x8_t wwVec, ooVec, eeVec;
-	wwVec = vld1q_u16((const uint16_t *)&currLine[(int)x-1]);
-	ooVec = vld1q_u16((const uint16_t *)&currLine[(int)x+0]);
-	eeVec = vld1q_u16((const uint16_t *)&currLine[(int)x+1]);
-	uint16x8_t swVec, ssVec, seVec;
-	swVec = vld1q_u16((const uint16_t *)&nextLine[(int)x-1]);
-	ssVec = vld1q_u16((const uint16_t *)&nextLine[(int)x+0]);
-	seVec = vld1q_u16((const uint16_t *)&nextLine[(int)x+1]);
+	vecEnd = getVectorEnd(width, 16);
+	for (size_t x = 0; x < vecEnd; x = getNextVector(x, 16, width)) {
+	  int8x16_t nwVec, nnVec, neVec;
+	  nwVec = vld1q_s8((const int8_t *)&prevLine[(int)x-1]);
+	  nnVec = vld1q_s8((const int8_t *)&prevLine[(int)x+0]);
+	  neVec = vld1q_s8((const int8_t *)&prevLine[(int)x+1]);
+	  int8x16_t wwVec, ooVec, eeVec;
+	  wwVec = vld1q_s8((const int8_t *)&currLine[(int)x-1]);
+	  ooVec = vld1q_s8((const int8_t *)&currLine[(int)x+0]);
+	  eeVec = vld1q_s8((const int8_t *)&currLine[(int)x+1]);
+	  int8x16_t swVec, ssVec, seVec;
+	  swVec = vld1q_s8((const int8_t *)&nextLine[(int)x-1]);
+	  ssVec = vld1q_s8((const int8_t *)&nextLine[(int)x+0]);
+	  seVec = vld1q_s8((const int8_t *)&nextLine[(int)x+1]);
 	
-	uint16x8_t sumVec;
-	sumVec = vdupq_n_u16((uint16_t)0);
-	sumVec = vsra_n_u16(sumVec, nwVec, 4);
-	sumVec = vsra_n_u16(sumVec, nnVec, 3);
-	sumVec = vsra_n_u16(sumVec, neVec, 4);
-	sumVec = vsra_n_u16(sumVec, wwVec, 3);
-	sumVec = vsra_n_u16(sumVec, ooVec, 2);
-	sumVec = vsra_n_u16(sumVec, eeVec, 3);
-	sumVec = vsra_n_u16(sumVec, swVec, 4);
-	sumVec = vsra_n_u16(sumVec, ssVec, 3);
-	sumVec = vsra_n_u16(sumVec, seVec, 4);
-	vst1q_u16((uint16_t *)&dstLine[x], sumVec);
-      }
+	  int8x16_t sumVec;
+	  sumVec = vdupq_n_s8((int8_t)0);
+	  sumVec = vsra_n_s8(sumVec, nwVec, 4);
+	  sumVec = vsra_n_s8(sumVec, nnVec, 3);
+	  sumVec = vsra_n_s8(sumVec, neVec, 4);
+	  sumVec = vsra_n_s8(sumVec, wwVec, 3);
+	  sumVec = vsra_n_s8(sumVec, ooVec, 2);
+	  sumVec = vsra_n_s8(sumVec, eeVec, 3);
+	  sumVec = vsra_n_s8(sumVec, swVec, 4);
+	  sumVec = vsra_n_s8(sumVec, ssVec, 3);
+	  sumVec = vsra_n_s8(sumVec, seVec, 4);
+	  vst1q_s8((int8_t *)&dstLine[x], sumVec);
+	}
 #endif
-      win3x3.shiftFrame(src, z);
+	for (size_t x = vecEnd; x < width; ++x)
+	  dstLine[x] = blurShifted3x3(prevLine, currLine, nextLine, (int)x);
+
+	win3x3.shiftFrame(src, z);
+      }
+    }
+  }
+}
+
+// packed pixels through the same sums: the vertical sums run over the samples of whole rows
+// read in place, the horizontal ones take the samples a pixel (channels) away, and the border
+// pixel is replicated in the sums. Every channel of a pixel sits in the same vector.
+template <typename T, typename S>
+inline void blurGaussian3x3Packed(cpackedpixmap<T>& dst, cpackedpixmap<T>& src)
+{
+  assert(dst.isMatched(src));
+  assert(dst.getLine(0) != src.getLine(0));
+
+  const size_t channels = src.getChannels();
+  const size_t len = src.getWidth() * channels;
+  const int height = (int)src.getHeight();
+  const size_t strips = getStripCount(src.getHeight());
+
+#pragma omp parallel for
+  for (size_t s = 0; s < strips; ++s) {
+    const int yBegin = (int)(src.getHeight() * s / strips);
+    const int yEnd = (int)(src.getHeight() * (s+1) / strips);
+
+    // vertical sums of the samples from pixel -1 to width
+    std::vector<S> vsumBuffer(len + (channels<<1));
+    S *vsum = &vsumBuffer[channels];
+
+    for (int y = yBegin; y < yEnd; ++y) {
+      sumVertical121(vsum, src.getLine(std::max(y-1, 0)), src.getLine(y), src.getLine(std::min(y+1, height-1)), len);
+      std::copy(vsum, vsum + channels, vsum - channels);
+      std::copy(vsum + len - channels, vsum + len, vsum + len);
+      roundHorizontal121(dst.getLine(y), vsum, len, channels);
     }
   }
 }
 
+inline void blurGaussian3x3Kernel(cpackedpixmap<uint8_t>& dst, cpackedpixmap<uint8_t>& src)
+{
+  blurGaussian3x3Packed<uint8_t, uint16_t>(dst, src);
+}
+
+inline void blurGaussian3x3Kernel(cpackedpixmap<uint16_t>& dst, cpackedpixmap<uint16_t>& src)
+{
+  blurGaussian3x3Packed<uint16_t, uint32_t>(dst, src);
+}
+
+inline void blurGaussian3x3Kernel(cpackedpixmap<float>& dst, cpackedpixmap<float>& src)
+{
+  blurGaussian3x3Packed<float, float>(dst, src);
+}
+
+inline void blurGaussian3x3Kernel(cpackedpixmap<double>& dst, cpackedpixmap<double>& src)
+{
+  blurGaussian3x3Packed<double, double>(dst, src);
+}
+
 inline void blurGaussian3x3Kernel(cpixmap<int16_t>& dst, cpixmap<int16_t>& src)
 {
   assert(dst.getWidth() == src.getWidth());
   assert(dst.getHeight() == src.getHeight());
   assert(dst.getBands() >= src.getBands());
 
+  const size_t width = src.getWidth();
+  const size_t strips = getStripCount(src.getHeight());
+
   for (size_t z = 0; z < src.getBands(); ++z) {
-    window3x3_frame<int16_t> win3x3(src);
-    win3x3.draftFrame(src, z);
-    
-    for (size_t y = 0; y < src.getHeight(); y++) {
-      int16_t *dstLine = dst.getLine(y, z);
-      int16_t *prevLine = win3x3.getPrevLine();
-      int16_t *currLine = win3x3.getCurrLine();
-      int16_t *nextLine = win3x3.getNextLine();
-
-      /*
-      nwVec|nnVec|neVec
-      -----+-----+-----
-      wwVec|ooVec|eeVec
-      -----+-----+-----
-      swVec|ssVec|seVec
-      */
 #pragma omp parallel for
+    for (size_t s = 0; s < strips; ++s) {
+      const size_t yBegin = src.getHeight() * s / strips;
+      const size_t yEnd = src.getHeight() * (s+1) / strips;
+      window3x3_frame<int16_t> win3x3(src);
+      win3x3.draftFrame(src, z, yBegin);
+    
+      for (size_t y = yBegin; y < yEnd; y++) {
+	int16_t *dstLine = dst.getLine(y, z);
+	int16_t *prevLine = win3x3.getPrevLine();
+	int16_t *currLine = win3x3.getCurrLine();
+	int16_t *nextLine = win3x3.getNextLine();
+
+	size_t vecEnd = 0;
 #if defined(__x86_64__) || defined(__i386__)
-# if INSTRSET >= 8 // AVXx - 256bits
-      for (size_t x = 0; x < src.getWidth(); x += 16) {
-	Vec16s nwVec, nnVec, neVec;
-	nwVec.load(&prevLine[(int)x-1]), nnVec.load(&prevLine[(int)x+0]), neVec.load(&prevLine[(int)x+1]);
-	Vec16s wwVec, ooVec, eeVec;
-	wwVec.load(&currLine[(int)x-1]), ooVec.load(&currLine[(int)x+0]), eeVec.load(&currLine[(int)x+0]);
-	Vec16s swVec, ssVec, seVec;
-	swVec.load(&nextLine[(int)x-1]), ssVec.load(&nextLine[(int)x+0]), seVec.load(&nextLine[(int)x+1]);
-	Vec16s dstVec =
-	  (nwVec>>4) + (nnVec>>3) + (neVec>>4) +
-	  (wwVec>>3) + (ooVec>>2) + (eeVec>>3) +
-	  (swVec>>4) + (ssVec>>3) + (seVec>>4);
-	dstVec.store(&dstLine[x]);
-      }
+# if INSTRSET >= 8 && defined(__AVX512BW__) && defined(__AVX512VL__) // AVX512 - 256bits, masked tails
+	vecEnd = blurShiftedMaskedLanes3x3<Vec16s>(dstLine, prevLine, currLine, nextLine, width);
+# elif INSTRSET >= 8 // AVXx - 256bits
+	vecEnd = blurShiftedLanes3x3<Vec16s>(dstLine, prevLine, currLine, nextLine, width);
 # elif INSTRSET >= 2 // SSE2 - 128bits
-      for (size_t x = 0; x < src.getWidth(); x += 8) {
-	Vec8s nwVec, nnVec, neVec;
-	nwVec.load(&prevLine[(int)x-1]), nnVec.load(&prevLine[(int)x+0]), neVec.load(&prevLine[(int)x+1]);
-	Vec8s wwVec, ooVec, eeVec;
-	wwVec.load(&currLine[(int)x-1]), ooVec.load(&currLine[(int)x+0]), eeVec.load(&currLine[(int)x+0]);
-	Vec8s swVec, ssVec, seVec;
-	swVec.load(&nextLine[(int)x-1]), ssVec.load(&nextLine[(int)x+0]), seVec.load(&nextLine[(int)x+1]);
-	Vec8s dstVec =
-	  (nwVec>>4) + (nnVec>>3) + (neVec>>4) +
-	  (wwVec>>3) + (ooVec>>2) + (eeVec>>3) +
-	  (swVec>>4) + (ssVec>>3) + (seVec>>4);
-	dstVec.store(&dstLine[x]);
-      }
+	vecEnd = blurShiftedLanes3x3<Vec8s>(dstLine, prevLine, currLine, nextLine, width);
 # endif
 #elif defined(__ARM_NEON__)
-      for (size_t x = 0; x < src.getWidth(); x += 8) {
-	int16x8_t nwVec, nnVec, neVec;
-	nwVec = vld1q_s16((const int16_t *)&prevLine[(int)x-1]);
-	nnVec = vld1q_s16((const int16_t *)&prevLine[(int)x+0]);
-	neVec = vld1q_s16((const int16_t *)&prevLine[(int)x+1]);
-	int16x8_t wwVec, ooVec, eeVec;
-	wwVec = vld1q_s16((const int16_t *)&currLine[(int)x-1]);
-	ooVec = vld1q_s16((const int16_t *)&currLine[(int)x+0]);
-	eeVec = vld1q_s16((const int16_t *)&currLine[(int)x+1]);
-	int16x8_t swVec, ssVec, seVec;
-	swVec = vld1q_s16((const int16_t *)&nextLine[(int)x-1]);
-	ssVec = vld1q_s16((const int16_t *)&nextLine[(int)x+0]);
-	seVec = vld1q_s16((const int16_t *)&nextLine[(int)x+1]);
+	vecEnd = getVectorEnd(width, 8);
+	for (size_t x = 0; x < vecEnd; x = getNextVector(x, 8, width)) {
+	  int16x8_t nwVec, nnVec, neVec;
+	  nwVec = vld1q_s16((const int16_t *)&prevLine[(int)x-1]);
+	  nnVec = vld1q_s16((const int16_t *)&prevLine[(int)x+0]);
+	  neVec = vld1q_s16((const int16_t *)&prevLine[(int)x+1]);
+	  int16x8_t wwVec, ooVec, eeVec;
+	  wwVec = vld1q_s16((const int16_t *)&currLine[(int)x-1]);
+	  ooVec = vld1q_s16((const int16_t *)&currLine[(int)x+0]);
+	  eeVec = vld1q_s16((const int16_t *)&currLine[(int)x+1]);
+	  int16x8_t swVec, ssVec, seVec;
+	  swVec = vld1q_s16((const int16_t *)&nextLine[(int)x-1]);
+	  ssVec = vld1q_s16((const int16_t *)&nextLine[(int)x+0]);
+	  seVec = vld1q_s16((const int16_t *)&nextLine[(int)x+1]);
 	
-	int16x8_t sumVec;
-	sumVec = vdupq_n_s16((int16_t)0);
-	sumVec = vsra_n_s16(sumVec, nwVec, 4);
-	sumVec = vsra_n_s16(sumVec, nnVec, 3);
-	sumVec = vsra_n_s16(sumVec, neVec, 4);
-	sumVec = vsra_n_s16(sumVec, wwVec, 3);
-	sumVec = vsra_n_s16(sumVec, ooVec, 2);
-	sumVec = vsra_n_s16(sumVec, eeVec, 3);
-	sumVec = vsra_n_s16(sumVec, swVec, 4);
-	sumVec = vsra_n_s16(sumVec, ssVec, 3);
-	sumVec = vsra_n_s16(sumVec, seVec, 4);
-	vst1q_s16((int16_t *)&dstLine[x], sumVec);
-      }
+	  int16x8_t sumVec;
+	  sumVec = vdupq_n_s16((int16_t)0);
+	  sumVec = vsra_n_s16(sumVec, nwVec, 4);
+	  sumVec = vsra_n_s16(sumVec, nnVec, 3);
+	  sumVec = vsra_n_s16(sumVec, neVec, 4);
+	  sumVec = vsra_n_s16(sumVec, wwVec, 3);
+	  sumVec = vsra_n_s16(sumVec, ooVec, 2);
+	  sumVec = vsra_n_s16(sumVec, eeVec, 3);
+	  sumVec = vsra_n_s16(sumVec, swVec, 4);
+	  sumVec = vsra_n_s16(sumVec, ssVec, 3);
+	  sumVec = vsra_n_s16(sumVec, seVec, 4);
+	  vst1q_s16((int16_t *)&dstLine[x], sumVec);
+	}
 #endif
-      win3x3.shiftFrame(src, z);
+	for (size_t x = vecEnd; x < width; ++x)
+	  dstLine[x] = blurShifted3x3(prevLine, currLine, nextLine, (int)x);
+
+	win3x3.shiftFrame(src, z);
+      }
     }
   }
 }
@@ -393,98 +754,67 @@ inline void blurGaussian3x3Kernel(cpixmap<uint32_t>& dst, cpixmap<uint32_t>& src
   assert(dst.getHeight() == src.getHeight());
   assert(dst.getBands() >= src.getBands());
 
+  const size_t width = src.getWidth();
+  const size_t strips = getStripCount(src.getHeight());
+
   for (size_t z = 0; z < src.getBands(); ++z) {
-    window3x3_frame<uint32_t> win3x3(src);
-    win3x3.draftFrame(src, z);
-    
-    for (size_t y = 0; y < src.getHeight(); y++) {
-      uint32_t *dstLine = dst.getLine(y, z);
-      uint32_t *prevLine = win3x3.getPrevLine();
-      uint32_t *currLine = win3x3.getCurrLine();
-      uint32_t *nextLine = win3x3.getNextLine();
-
-      /*
-      nwVec|nnVec|neVec
-      -----+-----+-----
-      wwVec|ooVec|eeVec
-      -----+-----+-----
-      swVec|ssVec|seVec
-      */
 #pragma omp parallel for
+    for (size_t s = 0; s < strips; ++s) {
+      const size_t yBegin = src.getHeight() * s / strips;
+      const size_t yEnd = src.getHeight() * (s+1) / strips;
+      window3x3_frame<uint32_t> win3x3(src);
+      win3x3.draftFrame(src, z, yBegin);
+    
+      for (size_t y = yBegin; y < yEnd; y++) {
+	uint32_t *dstLine = dst.getLine(y, z);
+	uint32_t *prevLine = win3x3.getPrevLine();
+	uint32_t *currLine = win3x3.getCurrLine();
+	uint32_t *nextLine = win3x3.getNextLine();
+
+	size_t vecEnd = 0;
 #if defined(__x86_64__) || defined(__i386__)
-# if INSTRSET >= 9 // AVX512 - 512bits
-      for (size_t x = 0; x < src.getWidth(); x += 16) {
-	Vec16ui nwVec, nnVec, neVec;
-	nwVec.load(&prevLine[(int)x-1]), nnVec.load(&prevLine[(int)x+0]), neVec.load(&prevLine[(int)x+1]);
-	Vec16ui wwVec, ooVec, eeVec;
-	wwVec.load(&currLine[(int)x-1]), ooVec.load(&currLine[(int)x+0]), eeVec.load(&currLine[(int)x+0]);
-	Vec16ui swVec, ssVec, seVec;
-	swVec.load(&nextLine[(int)x-1]), ssVec.load(&nextLine[(int)x+0]), seVec.load(&nextLine[(int)x+1]);
-	Vec16ui dstVec =
-	  (nwVec>>4) + (nnVec>>3) + (neVec>>4) +
-	  (wwVec>>3) + (ooVec>>2) + (eeVec>>3) +
-	  (swVec>>4) + (ssVec>>3) + (seVec>>4);
-	dstVec.store(&dstLine[x]);
-      }
+# if INSTRSET >= 9 // AVX512 - 512bits, masked tails
+	vecEnd = blurShiftedMaskedLanes3x3<Vec16ui>(dstLine, prevLine, currLine, nextLine, width);
 # elif INSTRSET >= 8 // AVX2 - 256bits
-      for (size_t x = 0; x < src.getWidth(); x += 8) {
-	Vec8ui nwVec, nnVec, neVec;
-	nwVec.load(&prevLine[(int)x-1]), nnVec.load(&prevLine[(int)x+0]), neVec.load(&prevLine[(int)x+1]);
-	Vec8ui wwVec, ooVec, eeVec;
-	wwVec.load(&currLine[(int)x-1]), ooVec.load(&currLine[(int)x+0]), eeVec.load(&currLine[(int)x+0]);
-	Vec8ui swVec, ssVec, seVec;
-	swVec.load(&nextLine[(int)x-1]), ssVec.load(&nextLine[(int)x+0]), seVec.load(&nextLine[(int)x+1]);
-	Vec8ui dstVec =
-	  (nwVec>>4) + (nnVec>>3) + (neVec>>4) +
-	  (wwVec>>3) + (ooVec>>2) + (eeVec>>3) +
-	  (swVec>>4) + (ssVec>>3) + (seVec>>4);
-	dstVec.store(&dstLine[x]);
-      }
+	vecEnd = blurShiftedLanes3x3<Vec8ui>(dstLine, prevLine, currLine, nextLine, width);
 # elif INSTRSET >= 2 // SSE2 - 128bits
-      for (size_t x = 0; x < src.getWidth(); x += 4) {
-	Vec4ui nwVec, nnVec, neVec;
-	nwVec.load(&prevLine[(int)x-1]), nnVec.load(&prevLine[(int)x+0]), neVec.load(&prevLine[(int)x+1]);
-	Vec4ui wwVec, ooVec, eeVec;
-	wwVec.load(&currLine[(int)x-1]), ooVec.load(&currLine[(int)x+0]), eeVec.load(&currLine[(int)x+0]);
-	Vec4ui swVec, ssVec, seVec;
-	swVec.load(&nextLine[(int)x-1]), ssVec.load(&nextLine[(int)x+0]), seVec.load(&nextLine[(int)x+1]);
-	Vec4ui dstVec =
-	  (nwVec>>4) + (nnVec>>3) + (neVec>>4) +
-	  (wwVec>>3) + (ooVec>>2) + (eeVec>>3) +
-	  (swVec>>4) + (ssVec>>3) + (seVec>>4);
-	dstVec.store(&dstLine[x]);
-      }
+	vecEnd = blurShiftedLanes3x3<Vec4ui>(dstLine, prevLine, currLine, nextLine, width);
 # endif
 #elif defined(__ARM_NEON__)
-      for (size_t x = 0; x < src.getWidth(); x += 4) {
-	uint32x4_t nwVec, nnVec, neVec;
-	nwVec = vld1q_u32((const uint32_t *)&prevLine[(int)x-1]);
-	nnVec = vld1q_u32((const uint32_t *)&prevLine[(int)x+0]);
-	neVec = vld1q_u32((const uint32_t *)&prevLine[(int)x+1]);
-	uint32x4_t wwVec, ooVec, eeVec;
-	wwVec = vld1q_u32((const uint32_t *)&currLine[(int)x-1]);
-	ooVec = vld1q_u32((const uint32_t *)&currLine[(int)x+0]);
-	eeVec = vld1q_u32((const uint32_t *)&currLine[(int)x+1]);
-	uint32x4_t swVec, ssVec, seVec;
-	swVec = vld1q_u32((const uint32_t *)&nextLine[(int)x-1]);
-	ssVec = vld1q_u32((const uint32_t *)&nextLine[(int)x+0]);
-	seVec = vld1q_u32((const uint32_t *)&nextLine[(int)x+1]);
+	vecEnd = getVectorEnd(width, 4);
+	for (size_t x = 0; x < vecEnd; x = getNextVector(x, 4, width)) {
+	  uint32x4_t nwVec, nnVec, neVec;
+	  nwVec = vld1q_u32((const uint32_t *)&prevLine[(int)x-1]);
+	  nnVec = vld1q_u32((const uint32_t *)&prevLine[(int)x+0]);
+	  neVec = vld1q_u32((const uint32_t *)&prevLine[(int)x+1]);
+	  uint32x4_t wwVec, ooVec, eeVec;
+	  wwVec = vld1q_u32((const uint32_t *)&currLine[(int)x-1]);
+	  ooVec = vld1q_u32((const uint32_t *)&currLine[(int)x+0]);
+	  eeVec = vld1q_u32((const uint32_t *)&currLine[(int)x+1]);
+	  uint32x4_t swVec, ssVec, seVec;
+	  swVec = vld1q_u32((const uint32_t *)&nextLine[(int)x-1]);
+	  ssVec = vld1q_u32((const uint32_t *)&nextLine[(int)x+0]);
+	  seVec = vld1q_u32((const uint32_t *)&nextLine[(int)x+1]);
 	
-	uint32x4_t sumVec;
-	sumVec = vdupq_n_u32((uint32_t)0);
-	sumVec = vsra_n_u32(sumVec, nwVec, 4);
-	sumVec = vsra_n_u32(sumVec, nnVec, 3);
-	sumVec = vsra_n_u32(sumVec, neVec, 4);
-	sumVec = vsra_n_u32(sumVec, wwVec, 3);
-	sumVec = vsra_n_u32(sumVec, ooVec, 2);
-	sumVec = vsra_n_u32(sumVec, eeVec, 3);
-	sumVec = vsra_n_u32(sumVec, swVec, 4);
-	sumVec = vsra_n_u32(sumVec, ssVec, 3);
-	sumVec = vsra_n_u32(sumVec, seVec, 4);
-	vst1q_u32((uint32_t *)&dstLine[x], sumVec);
-      }
+	  uint32x4_t sumVec;
+	  sumVec = vdupq_n_u32((uint32_t)0);
+	  sumVec = vsra_n_u32(sumVec, nwVec, 4);
+	  sumVec = vsra_n_u32(sumVec, nnVec, 3);
+	  sumVec = vsra_n_u32(sumVec, neVec, 4);
+	  sumVec = vsra_n_u32(sumVec, wwVec, 3);
+	  sumVec = vsra_n_u32(sumVec, ooVec, 2);
+	  sumVec = vsra_n_u32(sumVec, eeVec, 3);
+	  sumVec = vsra_n_u32(sumVec, swVec, 4);
+	  sumVec = vsra_n_u32(sumVec, ssVec, 3);
+	  sumVec = vsra_n_u32(sumVec, seVec, 4);
+	  vst1q_u32((uint32_t *)&dstLine[x], sumVec);
+	}
 #endif
-      win3x3.shiftFrame(src, z);
+	for (size_t x = vecEnd; x < width; ++x)
+	  dstLine[x] = blurShifted3x3(prevLine, currLine, nextLine, (int)x);
+
+	win3x3.shiftFrame(src, z);
+      }
     }
   }
 }
@@ -495,100 +825,575 @@ inline void blurGaussian3x3Kernel(cpixmap<int32_t>& dst, cpixmap<int32_t>& src)
   assert(dst.getHeight() == src.getHeight());
   assert(dst.getBands() >= src.getBands());
 
+  const size_t width = src.getWidth();
+  const size_t strips = getStripCount(src.getHeight());
+
   for (size_t z = 0; z < src.getBands(); ++z) {
-    window3x3_frame<int32_t> win3x3(src);
-    win3x3.draftFrame(src, z);
-    
-    for (size_t y = 0; y < src.getHeight(); y++) {
-      int32_t *dstLine = dst.getLine(y, z);
-      int32_t *prevLine = win3x3.getPrevLine();
-      int32_t *currLine = win3x3.getCurrLine();
-      int32_t *nextLine = win3x3.getNextLine();
-
-      /*
-      nwVec|nnVec|neVec
-      -----+-----+-----
-      wwVec|ooVec|eeVec
-      -----+-----+-----
-      swVec|ssVec|seVec
-      */
 #pragma omp parallel for
+    for (size_t s = 0; s < strips; ++s) {
+      const size_t yBegin = src.getHeight() * s / strips;
+      const size_t yEnd = src.getHeight() * (s+1) / strips;
+      window3x3_frame<int32_t> win3x3(src);
+      win3x3.draftFrame(src, z, yBegin);
+    
+      for (size_t y = yBegin; y < yEnd; y++) {
+	int32_t *dstLine = dst.getLine(y, z);
+	int32_t *prevLine = win3x3.getPrevLine();
+	int32_t *currLine = win3x3.getCurrLine();
+	int32_t *nextLine = win3x3.getNextLine();
+
+	size_t vecEnd = 0;
 #if defined(__x86_64__) || defined(__i386__)
-# if INSTRSET >= 9 // AVX512 - 512bits
-      for (size_t x = 0; x < src.getWidth(); x += 16) {
-	Vec16i nwVec, nnVec, neVec;
-	nwVec.load(&prevLine[(int)x-1]), nnVec.load(&prevLine[(int)x+0]), neVec.load(&prevLine[(int)x+1]);
-	Vec16i wwVec, ooVec, eeVec;
-	wwVec.load(&currLine[(int)x-1]), ooVec.load(&currLine[(int)x+0]), eeVec.load(&currLine[(int)x+0]);
-	Vec16i swVec, ssVec, seVec;
-	swVec.load(&nextLine[(int)x-1]), ssVec.load(&nextLine[(int)x+0]), seVec.load(&nextLine[(int)x+1]);
-	Vec16i dstVec =
-	  (nwVec>>4) + (nnVec>>3) + (neVec>>4) +
-	  (wwVec>>3) + (ooVec>>2) + (eeVec>>3) +
-	  (swVec>>4) + (ssVec>>3) + (seVec>>4);
-	dstVec.store(&dstLine[x]);
-      }
+# if INSTRSET >= 9 // AVX512 - 512bits, masked tails
+	vecEnd = blurShiftedMaskedLanes3x3<Vec16i>(dstLine, prevLine, currLine, nextLine, width);
 # elif INSTRSET >= 8 // AVX2 - 256bits
-      for (size_t x = 0; x < src.getWidth(); x += 8) {
-	Vec8i nwVec, nnVec, neVec;
-	nwVec.load(&prevLine[(int)x-1]), nnVec.load(&prevLine[(int)x+0]), neVec.load(&prevLine[(int)x+1]);
-	Vec8i wwVec, ooVec, eeVec;
-	wwVec.load(&currLine[(int)x-1]), ooVec.load(&currLine[(int)x+0]), eeVec.load(&currLine[(int)x+0]);
-	Vec8i swVec, ssVec, seVec;
-	swVec.load(&nextLine[(int)x-1]), ssVec.load(&nextLine[(int)x+0]), seVec.load(&nextLine[(int)x+1]);
-	Vec8i dstVec =
-	  (nwVec>>4) + (nnVec>>3) + (neVec>>4) +
-	  (wwVec>>3) + (ooVec>>2) + (eeVec>>3) +
-	  (swVec>>4) + (ssVec>>3) + (seVec>>4);
-	dstVec.store(&dstLine[x]);
-      }
+	vecEnd = blurShiftedLanes3x3<Vec8i>(dstLine, prevLine, currLine, nextLine, width);
 # elif INSTRSET >= 2 // SSE2 - 128bits
-      for (size_t x = 0; x < src.getWidth(); x += 4) {
-	Vec4i nwVec, nnVec, neVec;
-	nwVec.load(&prevLine[(int)x-1]), nnVec.load(&prevLine[(int)x+0]), neVec.load(&prevLine[(int)x+1]);
-	Vec4i wwVec, ooVec, eeVec;
-	wwVec.load(&currLine[(int)x-1]), ooVec.load(&currLine[(int)x+0]), eeVec.load(&currLine[(int)x+0]);
-	Vec4i swVec, ssVec, seVec;
-	swVec.load(&nextLine[(int)x-1]), ssVec.load(&nextLine[(int)x+0]), seVec.load(&nextLine[(int)x+1]);
-	Vec4i dstVec =
-	  (nwVec>>4) + (nnVec>>3) + (neVec>>4) +
-	  (wwVec>>3) + (ooVec>>2) + (eeVec>>3) +
-	  (swVec>>4) + (ssVec>>3) + (seVec>>4);
-	dstVec.store(&dstLine[x]);
-      }
+	vecEnd = blurShiftedLanes3x3<Vec4i>(dstLine, prevLine, currLine, nextLine, width);
 # endif
 #elif defined(__ARM_NEON__)
-      for (size_t x = 0; x < src.getWidth(); x += 4) {
-	int32x4_t nwVec, nnVec, neVec;
-	nwVec = vld1q_s32((const int32_t *)&prevLine[(int)x-1]);
-	nnVec = vld1q_s32((const int32_t *)&prevLine[(int)x+0]);
-	neVec = vld1q_s32((const int32_t *)&prevLine[(int)x+1]);
-	int32x4_t wwVec, ooVec, eeVec;
-	wwVec = vld1q_s32((const int32_t *)&currLine[(int)x-1]);
-	ooVec = vld1q_s32((const int32_t *)&currLine[(int)x+0]);
-	eeVec = vld1q_s32((const int32_t *)&currLine[(int)x+1]);
-	int32x4_t swVec, ssVec, seVec;
-	swVec = vld1q_s32((const int32_t *)&nextLine[(int)x-1]);
-	ssVec = vld1q_s32((const int32_t *)&nextLine[(int)x+0]);
-	seVec = vld1q_s32((const int32_t *)&nextLine[(int)x+1]);
+	vecEnd = getVectorEnd(width, 4);
+	for (size_t x = 0; x < vecEnd; x = getNextVector(x, 4, width)) {
+	  int32x4_t nwVec, nnVec, neVec;
+	  nwVec = vld1q_s32((const int32_t *)&prevLine[(int)x-1]);
+	  nnVec = vld1q_s32((const int32_t *)&prevLine[(int)x+0]);
+	  neVec = vld1q_s32((const int32_t *)&prevLine[(int)x+1]);
+	  int32x4_t wwVec, ooVec, eeVec;
+	  wwVec = vld1q_s32((const int32_t *)&currLine[(int)x-1]);
+	  ooVec = vld1q_s32((const int32_t *)&currLine[(int)x+0]);
+	  eeVec = vld1q_s32((const int32_t *)&currLine[(int)x+1]);
+	  int32x4_t swVec, ssVec, seVec;
+	  swVec = vld1q_s32((const int32_t *)&nextLine[(int)x-1]);
+	  ssVec = vld1q_s32((const int32_t *)&nextLine[(int)x+0]);
+	  seVec = vld1q_s32((const int32_t *)&nextLine[(int)x+1]);
 	
-	int32x4_t sumVec;
-	sumVec = vdupq_n_s32((int32_t)0);
-	sumVec = vsra_n_s32(sumVec, nwVec, 4);
-	sumVec = vsra_n_s32(sumVec, nnVec, 3);
-	sumVec = vsra_n_s32(sumVec, neVec, 4);
-	sumVec = vsra_n_s32(sumVec, wwVec, 3);
-	sumVec = vsra_n_s32(sumVec, ooVec, 2);
-	sumVec = vsra_n_s32(sumVec, eeVec, 3);
-	sumVec = vsra_n_s32(sumVec, swVec, 4);
-	sumVec = vsra_n_s32(sumVec, ssVec, 3);
-	sumVec = vsra_n_s32(sumVec, seVec, 4);
-	vst1q_s32((int32_t *)&dstLine[x], sumVec);
+	  int32x4_t sumVec;
+	  sumVec = vdupq_n_s32((int32_t)0);
+	  sumVec = vsra_n_s32(sumVec, nwVec, 4);
+	  sumVec = vsra_n_s32(sumVec, nnVec, 3);
+	  sumVec = vsra_n_s32(sumVec, neVec, 4);
+	  sumVec = vsra_n_s32(sumVec, wwVec, 3);
+	  sumVec = vsra_n_s32(sumVec, ooVec, 2);
+	  sumVec = vsra_n_s32(sumVec, eeVec, 3);
+	  sumVec = vsra_n_s32(sumVec, swVec, 4);
+	  sumVec = vsra_n_s32(sumVec, ssVec, 3);
+	  sumVec = vsra_n_s32(sumVec, seVec, 4);
+	  vst1q_s32((int32_t *)&dstLine[x], sumVec);
+	}
+#endif
+	for (size_t x = vecEnd; x < width; ++x)
+	  dstLine[x] = blurShifted3x3(prevLine, currLine, nextLine, (int)x);
+
+	win3x3.shiftFrame(src, z);
+      }
+    }
+  }
+}
+
+inline void filterRecursiveStep(float *out, const float *in,
+				const float *p1, const float *p2, const float *p3, size_t len,
+				float B, float b1, float b2, float b3)
+{
+  size_t x = 0;
+#if defined(__x86_64__) || defined(__i386__)
+# if INSTRSET >= 9 // AVX512 - 512bits
+  const Vec16f BVec(B), b1Vec(b1), b2Vec(b2), b3Vec(b3);
+  for (; x + 16 <= len; x += 16) {
+    Vec16f inVec, p1Vec, p2Vec, p3Vec;
+    inVec.load(&in[x]), p1Vec.load(&p1[x]), p2Vec.load(&p2[x]), p3Vec.load(&p3[x]);
+    Vec16f outVec = mul_add(BVec, inVec, mul_add(b1Vec, p1Vec, mul_add(b2Vec, p2Vec, b3Vec*p3Vec)));
+    outVec.store(&out[x]);
+  }
+# elif INSTRSET >= 7 // AVXx - 256bits
+  const Vec8f BVec(B), b1Vec(b1), b2Vec(b2), b3Vec(b3);
+  for (; x + 8 <= len; x += 8) {
+    Vec8f inVec, p1Vec, p2Vec, p3Vec;
+    inVec.load(&in[x]), p1Vec.load(&p1[x]), p2Vec.load(&p2[x]), p3Vec.load(&p3[x]);
+    Vec8f outVec = mul_add(BVec, inVec, mul_add(b1Vec, p1Vec, mul_add(b2Vec, p2Vec, b3Vec*p3Vec)));
+    outVec.store(&out[x]);
+  }
+# elif INSTRSET >= 2 // SSE2 - 128bits
+  const Vec4f BVec(B), b1Vec(b1), b2Vec(b2), b3Vec(b3);
+  for (; x + 4 <= len; x += 4) {
+    Vec4f inVec, p1Vec, p2Vec, p3Vec;
+    inVec.load(&in[x]), p1Vec.load(&p1[x]), p2Vec.load(&p2[x]), p3Vec.load(&p3[x]);
+    Vec4f outVec = mul_add(BVec, inVec, mul_add(b1Vec, p1Vec, mul_add(b2Vec, p2Vec, b3Vec*p3Vec)));
+    outVec.store(&out[x]);
+  }
+# endif
+#elif defined(__ARM_NEON__)
+  const float32x4_t BVec = vdupq_n_f32(B), b1Vec = vdupq_n_f32(b1);
+  const float32x4_t b2Vec = vdupq_n_f32(b2), b3Vec = vdupq_n_f32(b3);
+  for (; x + 4 <= len; x += 4) {
+    float32x4_t outVec = vmulq_f32(b3Vec, vld1q_f32(&p3[x]));
+    outVec = vmlaq_f32(outVec, b2Vec, vld1q_f32(&p2[x]));
+    outVec = vmlaq_f32(outVec, b1Vec, vld1q_f32(&p1[x]));
+    outVec = vmlaq_f32(outVec, BVec, vld1q_f32(&in[x]));
+    vst1q_f32(&out[x], outVec);
+  }
+#endif
+  for (; x < len; ++x)
+    out[x] = B*in[x] + b1*p1[x] + b2*p2[x] + b3*p3[x];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// lanes of the directional kernels: the pixels in their own width, direction codes widened to it
+inline void loadLanes(Vec16uc& v, const uint8_t *p) { v.load(p); }
+inline void loadLanes(Vec8us& v, const uint16_t *p) { v.load(p); }
+inline void loadLanes(Vec8us& v, const uint8_t *p) { v = extend_low(Vec16uc(_mm_loadl_epi64((const __m128i *)p))); }
+inline void storeLanes(uint8_t *p, const Vec16uc& v) { v.store(p); }
+inline void storeLanes(uint16_t *p, const Vec8us& v) { v.store(p); }
+inline void storeLanes(uint8_t *p, const Vec8us& v) { _mm_storel_epi64((__m128i *)p, compress(v, v)); }
+// unsigned a > b as a signed compare of the sign-flipped lanes: VCL 1.27 returns Vec8s rather than
+// Vec8sb from the compare of two Vec8us, so all widths take this form and give the boolean vectors
+// select expects
+inline Vec16cb greaterLanes(const Vec16uc& a, const Vec16uc& b) { return Vec16c(a ^ Vec16uc(0x80)) > Vec16c(b ^ Vec16uc(0x80)); }
+inline Vec8sb greaterLanes(const Vec8us& a, const Vec8us& b) { return Vec8s(a ^ Vec8us(0x8000)) > Vec8s(b ^ Vec8us(0x8000)); }
+# if INSTRSET >= 8
+inline void loadLanes(Vec32uc& v, const uint8_t *p) { v.load(p); }
+inline void loadLanes(Vec16us& v, const uint16_t *p) { v.load(p); }
+inline void loadLanes(Vec16us& v, const uint8_t *p) { v = Vec16us(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)p))); }
+inline void storeLanes(uint8_t *p, const Vec32uc& v) { v.store(p); }
+inline void storeLanes(uint16_t *p, const Vec16us& v) { v.store(p); }
+inline void storeLanes(uint8_t *p, const Vec16us& v) { compress(v.get_low(), v.get_high()).store(p); }
+inline Vec32cb greaterLanes(const Vec32uc& a, const Vec32uc& b) { return Vec32c(a ^ Vec32uc(0x80)) > Vec32c(b ^ Vec32uc(0x80)); }
+inline Vec16sb greaterLanes(const Vec16us& a, const Vec16us& b) { return Vec16s(a ^ Vec16us(0x8000)) > Vec16s(b ^ Vec16us(0x8000)); }
+# endif
+
+// a + (a>>2) + (a>>3) + (a>>5) > d, the weighted difference of getDirection3x1 kept inside the lanes
+template <typename V, typename B>
+inline B isStrongerDirection(const V& a, const V& d)
+{
+  return greaterLanes(a, d) | greaterLanes(V((a>>2) + (a>>3) + (a>>5)), sub_saturated(d, a));
+}
+
+// vectorized getDirection3x1, returns where the scalar tail starts
+template <typename V, typename B, typename T>
+inline size_t classifyDirectionLanes3x1(uint8_t *dir, const T *prev, const T *curr, const T *next, size_t len)
+{
+  const size_t vecEnd = getVectorEnd(len, V::size());
+  const V hCode(HORIZONTAL), vCode(VERTICAL), d1Code(DIAGONAL1), d2Code(DIAGONAL2);
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, V::size(), len)) {
+    V nwVec, nnVec, neVec, wwVec, eeVec, swVec, ssVec, seVec;
+    loadLanes(nwVec, &prev[(int)x-1]), loadLanes(nnVec, &prev[x]), loadLanes(neVec, &prev[x+1]);
+    loadLanes(wwVec, &curr[(int)x-1]), loadLanes(eeVec, &curr[x+1]);
+    loadLanes(swVec, &next[(int)x-1]), loadLanes(ssVec, &next[x]), loadLanes(seVec, &next[x+1]);
+    V hDiff = sub_saturated(wwVec, eeVec) | sub_saturated(eeVec, wwVec);
+    V vDiff = sub_saturated(nnVec, ssVec) | sub_saturated(ssVec, nnVec);
+    V d1Diff = sub_saturated(neVec, swVec) | sub_saturated(swVec, neVec);
+    V d2Diff = sub_saturated(nwVec, seVec) | sub_saturated(seVec, nwVec);
+    // the weighting is strictly increasing, so hDir > vDir exactly when hDiff > vDiff
+    B hv = greaterLanes(hDiff, vDiff);
+    V best = select(hv, hDiff, vDiff);
+    V code = select(isStrongerDirection<V, B>(best, d2Diff), select(hv, hCode, vCode), d2Code);
+    code = select(isStrongerDirection<V, B>(best, d1Diff), code, select(greaterLanes(d1Diff, d2Diff), d1Code, d2Code));
+    storeLanes(&dir[x], code);
+  }
+  return vecEnd;
+}
+
+// vectorized voteDirection3x1 and blurDirection3x1, returns where the scalar tail starts
+template <typename V, typename B, typename T>
+inline size_t blurDirectionLanes3x1(T *dst, const uint8_t *dPrev, const uint8_t *dCurr, const uint8_t *dNext,
+				    const T *prev, const T *curr, const T *next, size_t len)
+{
+  const size_t vecEnd = getVectorEnd(len, V::size());
+  const V hCode(HORIZONTAL), vCode(VERTICAL), d1Code(DIAGONAL1), d2Code(DIAGONAL2);
+  const uint8_t *codes[3] = { dPrev, dCurr, dNext };
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, V::size(), len)) {
+    // a matching lane is all ones, subtracting it counts one
+    V hCount(0), vCount(0), d1Count(0), d2Count(0);
+    for (int dy = 0; dy < 3; ++dy) {
+      for (int dx = -1; dx <= 1; ++dx) {
+	V codeVec;
+	loadLanes(codeVec, &codes[dy][(int)x+dx]);
+	hCount -= V(codeVec == hCode), vCount -= V(codeVec == vCode);
+	d1Count -= V(codeVec == d1Code), d2Count -= V(codeVec == d2Code);
+      }
+    }
+    B hv = greaterLanes(hCount, vCount);
+    V best = select(hv, hCount, vCount);
+    V code = select(greaterLanes(best, d2Count), select(hv, hCode, vCode), d2Code);
+    code = select(greaterLanes(best, d1Count), code, select(greaterLanes(d1Count, d2Count), d1Code, d2Code));
+
+    V nwVec, nnVec, neVec, wwVec, ooVec, eeVec, swVec, ssVec, seVec;
+    loadLanes(nwVec, &prev[(int)x-1]), loadLanes(nnVec, &prev[x]), loadLanes(neVec, &prev[x+1]);
+    loadLanes(wwVec, &curr[(int)x-1]), loadLanes(ooVec, &curr[x]), loadLanes(eeVec, &curr[x+1]);
+    loadLanes(swVec, &next[(int)x-1]), loadLanes(ssVec, &next[x]), loadLanes(seVec, &next[x+1]);
+    B isH = B(code == hCode), isV = B(code == vCode), isD1 = B(code == d1Code);
+    V aVec = select(isH, wwVec, select(isV, nnVec, select(isD1, neVec, nwVec)));
+    V bVec = select(isH, eeVec, select(isV, ssVec, select(isD1, swVec, seVec)));
+    storeLanes(&dst[x], V((aVec>>2) + (ooVec>>1) + (bVec>>2)));
+  }
+  return vecEnd;
+}
+#endif
+
+// direction codes of one line, 8-bit lanes need no widening as the weighted difference is kept below 255
+inline void classifyDirectionLine3x1(uint8_t *dir, const uint8_t *prev, const uint8_t *curr, const uint8_t *next, size_t len)
+{
+  size_t vecEnd = 0;
+#if defined(__x86_64__) || defined(__i386__)
+# if INSTRSET >= 8 // AVXx - 256bits, also for AVX512
+  vecEnd = classifyDirectionLanes3x1<Vec32uc, Vec32cb>(dir, prev, curr, next, len);
+# elif INSTRSET >= 2 // SSE2 - 128bits
+  vecEnd = classifyDirectionLanes3x1<Vec16uc, Vec16cb>(dir, prev, curr, next, len);
+# endif
+#endif
+  for (size_t x = vecEnd; x < len; ++x)
+    dir[x] = getDirection3x1(prev, curr, next, (int)x);
+}
+
+inline void classifyDirectionLine3x1(uint8_t *dir, const uint16_t *prev, const uint16_t *curr, const uint16_t *next, size_t len)
+{
+  size_t vecEnd = 0;
+#if defined(__x86_64__) || defined(__i386__)
+# if INSTRSET >= 8 // AVXx - 256bits, also for AVX512
+  vecEnd = classifyDirectionLanes3x1<Vec16us, Vec16sb>(dir, prev, curr, next, len);
+# elif INSTRSET >= 2 // SSE2 - 128bits
+  vecEnd = classifyDirectionLanes3x1<Vec8us, Vec8sb>(dir, prev, curr, next, len);
+# endif
+#endif
+  for (size_t x = vecEnd; x < len; ++x)
+    dir[x] = getDirection3x1(prev, curr, next, (int)x);
+}
+
+inline void blurDirectionLine3x1(uint8_t *dst, const uint8_t *dPrev, const uint8_t *dCurr, const uint8_t *dNext,
+				 const uint8_t *prev, const uint8_t *curr, const uint8_t *next, size_t len)
+{
+  size_t vecEnd = 0;
+#if defined(__x86_64__) || defined(__i386__)
+# if INSTRSET >= 8 // AVXx - 256bits, also for AVX512
+  vecEnd = blurDirectionLanes3x1<Vec32uc, Vec32cb>(dst, dPrev, dCurr, dNext, prev, curr, next, len);
+# elif INSTRSET >= 2 // SSE2 - 128bits
+  vecEnd = blurDirectionLanes3x1<Vec16uc, Vec16cb>(dst, dPrev, dCurr, dNext, prev, curr, next, len);
+# endif
+#endif
+  for (size_t x = vecEnd; x < len; ++x)
+    dst[x] = blurDirection3x1(voteDirection3x1(dPrev, dCurr, dNext, (int)x), prev, curr, next, (int)x);
+}
+
+inline void blurDirectionLine3x1(uint16_t *dst, const uint8_t *dPrev, const uint8_t *dCurr, const uint8_t *dNext,
+				 const uint16_t *prev, const uint16_t *curr, const uint16_t *next, size_t len)
+{
+  size_t vecEnd = 0;
+#if defined(__x86_64__) || defined(__i386__)
+# if INSTRSET >= 8 // AVXx - 256bits, also for AVX512
+  vecEnd = blurDirectionLanes3x1<Vec16us, Vec16sb>(dst, dPrev, dCurr, dNext, prev, curr, next, len);
+# elif INSTRSET >= 2 // SSE2 - 128bits
+  vecEnd = blurDirectionLanes3x1<Vec8us, Vec8sb>(dst, dPrev, dCurr, dNext, prev, curr, next, len);
+# endif
+#endif
+  for (size_t x = vecEnd; x < len; ++x)
+    dst[x] = blurDirection3x1(voteDirection3x1(dPrev, dCurr, dNext, (int)x), prev, curr, next, (int)x);
+}
+
+// same two sweeps as blurDirectionalGaussian3x1KernelReference with the lines vectorized
+template <typename T>
+inline void blurDirectionalGaussian3x1Lines(cpixmap<T>& dst, cpixmap<uint8_t>& dirmap, cpixmap<T>& src)
+{
+  assert(dst.isMatched(src));
+  assert(dst.isMatched(dirmap));
+
+  const size_t width = src.getWidth();
+  const size_t strips = getStripCount(src.getHeight());
+
+  for (size_t z = 0; z < src.getBands(); ++z) {
+#pragma omp parallel for
+    for (size_t s = 0; s < strips; ++s) {
+      const size_t yBegin = src.getHeight() * s / strips;
+      const size_t yEnd = src.getHeight() * (s+1) / strips;
+      window3x3_frame<T> win3x3(src);
+      win3x3.draftFrame(src, z, yBegin);
+
+      for (size_t y = yBegin; y < yEnd; ++y) {
+	classifyDirectionLine3x1(dirmap.getLine(y, z), win3x3.getPrevLine(), win3x3.getCurrLine(), win3x3.getNextLine(), width);
+	win3x3.shiftFrame(src, z);
+      }
+    }
+  }
+
+  for (size_t z = 0; z < src.getBands(); ++z) {
+#pragma omp parallel for
+    for (size_t s = 0; s < strips; ++s) {
+      const size_t yBegin = src.getHeight() * s / strips;
+      const size_t yEnd = src.getHeight() * (s+1) / strips;
+      window3x3_frame<uint8_t> dir3x3(dirmap);
+      dir3x3.draftFrame(dirmap, z, yBegin);
+      window3x3_frame<T> img3x3(src);
+      img3x3.draftFrame(src, z, yBegin);
+
+      for (size_t y = yBegin; y < yEnd; ++y) {
+	blurDirectionLine3x1(dst.getLine(y, z), dir3x3.getPrevLine(), dir3x3.getCurrLine(), dir3x3.getNextLine(),
+			     img3x3.getPrevLine(), img3x3.getCurrLine(), img3x3.getNextLine(), width);
+	dir3x3.shiftFrame(dirmap, z);
+	img3x3.shiftFrame(src, z);
+      }
+    }
+  }
+}
+
+// same sweep as the fused blurDirectionalGaussian3x1KernelReference with the lines vectorized
+template <typename T>
+inline void blurDirectionalGaussian3x1Fused(cpixmap<T>& dst, cpixmap<T>& src)
+{
+  assert(dst.isMatched(src));
+
+  const int width = (int)src.getWidth();
+  const int height = (int)src.getHeight();
+  const size_t strips = getStripCount(src.getHeight());
+
+  for (size_t z = 0; z < src.getBands(); ++z) {
+#pragma omp parallel for
+    for (size_t s = 0; s < strips; ++s) {
+      const int yBegin = (int)(src.getHeight() * s / strips);
+      const int yEnd = (int)(src.getHeight() * (s+1) / strips);
+      cdirectionring ring(width);
+      int dirRow = std::max(yBegin-1, 0);
+      window3x3_frame<T> win3x3(src);
+      win3x3.draftFrame(src, z, dirRow);
+      window3x3_frame<T> img3x3(src);
+      img3x3.draftFrame(src, z, yBegin);
+
+      for (int y = yBegin; y < yEnd; ++y) {
+	for (; dirRow <= std::min(y+1, height-1); ++dirRow) {
+	  classifyDirectionLine3x1(ring.getLine(dirRow), win3x3.getPrevLine(), win3x3.getCurrLine(), win3x3.getNextLine(), width);
+	  ring.fillLine(dirRow);
+	  win3x3.shiftFrame(src, z);
+	}
+	blurDirectionLine3x1(dst.getLine(y, z), ring.getLine(y-1, height), ring.getLine(y), ring.getLine(y+1, height),
+			     img3x3.getPrevLine(), img3x3.getCurrLine(), img3x3.getNextLine(), width);
+	img3x3.shiftFrame(src, z);
+      }
+    }
+  }
+}
+
+inline void blurDirectionalGaussian3x1Kernel(cpixmap<uint8_t>& dst, cpixmap<uint8_t>& dirmap, cpixmap<uint8_t>& src)
+{
+  blurDirectionalGaussian3x1Lines(dst, dirmap, src);
+}
+
+inline void blurDirectionalGaussian3x1Kernel(cpixmap<uint16_t>& dst, cpixmap<uint8_t>& dirmap, cpixmap<uint16_t>& src)
+{
+  blurDirectionalGaussian3x1Lines(dst, dirmap, src);
+}
+
+inline void blurDirectionalGaussian3x1Kernel(cpixmap<uint8_t>& dst, cpixmap<uint8_t>& src)
+{
+  blurDirectionalGaussian3x1Fused(dst, src);
+}
+
+inline void blurDirectionalGaussian3x1Kernel(cpixmap<uint16_t>& dst, cpixmap<uint16_t>& src)
+{
+  blurDirectionalGaussian3x1Fused(dst, src);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// wide signed lanes for the scaled differences of the 8 orientations, direction codes narrowed back to bytes
+inline void loadLanes(Vec8s& v, const uint8_t *p) { v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)p), _mm_setzero_si128()); }
+inline void loadLanes(Vec4i& v, const uint16_t *p) { v = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)p), _mm_setzero_si128()); }
+inline void storeLanes(uint8_t *p, const Vec8s& v) { _mm_storel_epi64((__m128i *)p, _mm_packus_epi16(v, v)); }
+inline void storeLanes(uint8_t *p, const Vec4i& v)
+{
+  int32_t codes = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(v, v), _mm_setzero_si128()));
+  memcpy(p, &codes, sizeof(codes));
+}
+# if INSTRSET >= 8
+inline void loadLanes(Vec16s& v, const uint8_t *p) { v = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)p)); }
+inline void loadLanes(Vec8i& v, const uint16_t *p) { v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)p)); }
+inline void storeLanes(uint8_t *p, const Vec16s& v) { _mm_storeu_si128((__m128i *)p, _mm_packus_epi16(v.get_low(), v.get_high())); }
+inline void storeLanes(uint8_t *p, const Vec8i& v) { storeLanes(p, Vec8s(_mm_packs_epi32(v.get_low(), v.get_high()))); }
+# endif
+# if INSTRSET >= 9
+inline void loadLanes(Vec16i& v, const uint16_t *p) { v = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)p)); }
+inline void storeLanes(uint8_t *p, const Vec16i& v) { _mm_storeu_si128((__m128i *)p, _mm512_cvtepi32_epi8(v)); }
+# endif
+
+// vectorized getDirection5x1 in lanes wide enough for the scaled differences, returns where the scalar tail starts
+template <typename W, typename T>
+inline size_t classifyDirectionLanes5x1(uint8_t *dir, const T *const *lines, size_t len)
+{
+  const size_t vecEnd = getVectorEnd(len, W::size());
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, W::size(), len)) {
+    W bestDiff(-1), code(ORIENTATION_0);
+    for (int i = ORIENTATION_0; i < NR_ORIENTATION; ++i) {
+      const int dx = orientationTaps[i][2], dy = orientationTaps[i][3];
+      W aVec, bVec;
+      loadLanes(aVec, &lines[2+dy][(int)x+dx]), loadLanes(bVec, &lines[2-dy][(int)x-dx]);
+      W diff = abs(aVec - bVec);
+      if ((i & 3) == 0) diff = diff + (diff>>2) + (diff>>3) + (diff>>5);
+      else if (i & 1) diff = diff + (diff>>2) + (diff>>6);
+      // the differences are non-negative, so signed compares are exact
+      auto gt = diff > bestDiff;
+      bestDiff = select(gt, diff, bestDiff);
+      code = select(gt, W(i), code);
+    }
+    storeLanes(&dir[x], code);
+  }
+  return vecEnd;
+}
+
+// vectorized voteDirection5x1 and blurDirection5x1, returns where the scalar tail starts
+template <typename V, typename B, typename T>
+inline size_t blurDirectionLanes5x1(T *dst, const uint8_t *dPrev, const uint8_t *dCurr, const uint8_t *dNext,
+				    const T *const *lines, size_t len)
+{
+  const size_t vecEnd = getVectorEnd(len, V::size());
+  const uint8_t *codes[3] = { dPrev, dCurr, dNext };
+  for (size_t x = 0; x < vecEnd; x = getNextVector(x, V::size(), len)) {
+    V count[NR_ORIENTATION];
+    for (int i = ORIENTATION_0; i < NR_ORIENTATION; ++i) count[i] = V(0);
+    for (int dy = 0; dy < 3; ++dy) {
+      for (int dx = -1; dx <= 1; ++dx) {
+	V codeVec;
+	loadLanes(codeVec, &codes[dy][(int)x+dx]);
+	for (int i = ORIENTATION_0; i < NR_ORIENTATION; ++i)
+	  count[i] -= V(codeVec == V(i));
+      }
+    }
+    V best = count[ORIENTATION_0], code(ORIENTATION_0);
+    for (int i = ORIENTATION_22; i < NR_ORIENTATION; ++i) {
+      B gt = greaterLanes(count[i], best);
+      best = select(gt, count[i], best);
+      code = select(gt, V(i), code);
+    }
+
+    // taps of the last orientation, replaced where the code says otherwise
+    V m2Vec, m1Vec, p1Vec, p2Vec, ooVec;
+    for (int i = NR_ORIENTATION-1; i >= ORIENTATION_0; --i) {
+      const int dx1 = orientationTaps[i][0], dy1 = orientationTaps[i][1];
+      const int dx2 = orientationTaps[i][2], dy2 = orientationTaps[i][3];
+      V aVec, bVec, cVec, dVec;
+      loadLanes(aVec, &lines[2-dy2][(int)x-dx2]), loadLanes(bVec, &lines[2-dy1][(int)x-dx1]);
+      loadLanes(cVec, &lines[2+dy1][(int)x+dx1]), loadLanes(dVec, &lines[2+dy2][(int)x+dx2]);
+      if (i == NR_ORIENTATION-1) {
+	m2Vec = aVec, m1Vec = bVec, p1Vec = cVec, p2Vec = dVec;
+      } else {
+	B is = B(code == V(i));
+	m2Vec = select(is, aVec, m2Vec), m1Vec = select(is, bVec, m1Vec);
+	p1Vec = select(is, cVec, p1Vec), p2Vec = select(is, dVec, p2Vec);
       }
+    }
+    loadLanes(ooVec, &lines[2][x]);
+    storeLanes(&dst[x], V((m2Vec>>4) + (m1Vec>>2) + (ooVec>>2) + (ooVec>>3) + (p1Vec>>2) + (p2Vec>>4)));
+  }
+  return vecEnd;
+}
+#endif
+
+inline void classifyDirectionLine5x1(uint8_t *dir, const uint8_t *const *lines, size_t len)
+{
+  size_t vecEnd = 0;
+#if defined(__x86_64__) || defined(__i386__)
+# if INSTRSET >= 8 // AVXx - 256bits, also for AVX512
+  vecEnd = classifyDirectionLanes5x1<Vec16s>(dir, lines, len);
+# elif INSTRSET >= 2 // SSE2 - 128bits
+  vecEnd = classifyDirectionLanes5x1<Vec8s>(dir, lines, len);
+# endif
+#endif
+  for (size_t x = vecEnd; x < len; ++x)
+    dir[x] = getDirection5x1(lines, (int)x);
+}
+
+inline void classifyDirectionLine5x1(uint8_t *dir, const uint16_t *const *lines, size_t len)
+{
+  size_t vecEnd = 0;
+#if defined(__x86_64__) || defined(__i386__)
+# if INSTRSET >= 9 // AVX512 - 512bits
+  vecEnd = classifyDirectionLanes5x1<Vec16i>(dir, lines, len);
+# elif INSTRSET >= 8 // AVXx - 256bits
+  vecEnd = classifyDirectionLanes5x1<Vec8i>(dir, lines, len);
+# elif INSTRSET >= 2 // SSE2 - 128bits
+  vecEnd = classifyDirectionLanes5x1<Vec4i>(dir, lines, len);
+# endif
+#endif
+  for (size_t x = vecEnd; x < len; ++x)
+    dir[x] = getDirection5x1(lines, (int)x);
+}
+
+inline void blurDirectionLine5x1(uint8_t *dst, const uint8_t *dPrev, const uint8_t *dCurr, const uint8_t *dNext,
+				 const uint8_t *const *lines, size_t len)
+{
+  size_t vecEnd = 0;
+#if defined(__x86_64__) || defined(__i386__)
+# if INSTRSET >= 8 // AVXx - 256bits, also for AVX512
+  vecEnd = blurDirectionLanes5x1<Vec32uc, Vec32cb>(dst, dPrev, dCurr, dNext, lines, len);
+# elif INSTRSET >= 2 // SSE2 - 128bits
+  vecEnd = blurDirectionLanes5x1<Vec16uc, Vec16cb>(dst, dPrev, dCurr, dNext, lines, len);
+# endif
+#endif
+  for (size_t x = vecEnd; x < len; ++x)
+    dst[x] = blurDirection5x1(voteDirection5x1(dPrev, dCurr, dNext, (int)x), lines, (int)x);
+}
+
+inline void blurDirectionLine5x1(uint16_t *dst, const uint8_t *dPrev, const uint8_t *dCurr, const uint8_t *dNext,
+				 const uint16_t *const *lines, size_t len)
+{
+  size_t vecEnd = 0;
+#if defined(__x86_64__) || defined(__i386__)
+# if INSTRSET >= 8 // AVXx - 256bits, also for AVX512
+  vecEnd = blurDirectionLanes5x1<Vec16us, Vec16sb>(dst, dPrev, dCurr, dNext, lines, len);
+# elif INSTRSET >= 2 // SSE2 - 128bits
+  vecEnd = blurDirectionLanes5x1<Vec8us, Vec8sb>(dst, dPrev, dCurr, dNext, lines, len);
+# endif
 #endif
-      win3x3.shiftFrame(src, z);
+  for (size_t x = vecEnd; x < len; ++x)
+    dst[x] = blurDirection5x1(voteDirection5x1(dPrev, dCurr, dNext, (int)x), lines, (int)x);
+}
+
+// same two sweeps as blurDirectionalGaussian5x1KernelReference with the lines vectorized
+template <typename T>
+inline void blurDirectionalGaussian5x1Lines(cpixmap<T>& dst, cpixmap<uint8_t>& dirmap, cpixmap<T>& src)
+{
+  assert(dst.isMatched(src));
+  assert(dst.isMatched(dirmap));
+
+  const size_t width = src.getWidth();
+  const size_t strips = getStripCount(src.getHeight());
+
+  for (size_t z = 0; z < src.getBands(); ++z) {
+#pragma omp parallel for
+    for (size_t s = 0; s < strips; ++s) {
+      const size_t yBegin = src.getHeight() * s / strips;
+      const size_t yEnd = src.getHeight() * (s+1) / strips;
+      window5x5_frame<T> win5x5(src);
+      win5x5.draftFrame(src, z, yBegin);
+
+      for (size_t y = yBegin; y < yEnd; ++y) {
+	const T *lines[5] = { win5x5.getLine(-2), win5x5.getLine(-1), win5x5.getLine(0), win5x5.getLine(1), win5x5.getLine(2) };
+	classifyDirectionLine5x1(dirmap.getLine(y, z), lines, width);
+	win5x5.shiftFrame(src, z);
+      }
+    }
+  }
+
+  for (size_t z = 0; z < src.getBands(); ++z) {
+#pragma omp parallel for
+    for (size_t s = 0; s < strips; ++s) {
+      const size_t yBegin = src.getHeight() * s / strips;
+      const size_t yEnd = src.getHeight() * (s+1) / strips;
+      window3x3_frame<uint8_t> dir3x3(dirmap);
+      dir3x3.draftFrame(dirmap, z, yBegin);
+      window5x5_frame<T> img5x5(src);
+      img5x5.draftFrame(src, z, yBegin);
+
+      for (size_t y = yBegin; y < yEnd; ++y) {
+	const T *lines[5] = { img5x5.getLine(-2), img5x5.getLine(-1), img5x5.getLine(0), img5x5.getLine(1), img5x5.getLine(2) };
+	blurDirectionLine5x1(dst.getLine(y, z), dir3x3.getPrevLine(), dir3x3.getCurrLine(), dir3x3.getNextLine(), lines, width);
+	dir3x3.shiftFrame(dirmap, z);
+	img5x5.shiftFrame(src, z);
+      }
     }
   }
 }
 
+inline void blurDirectionalGaussian5x1Kernel(cpixmap<uint8_t>& dst, cpixmap<uint8_t>& dirmap, cpixmap<uint8_t>& src)
+{
+  blurDirectionalGaussian5x1Lines(dst, dirmap, src);
+}
 
+inline void blurDirectionalGaussian5x1Kernel(cpixmap<uint16_t>& dst, cpixmap<uint8_t>& dirmap, cpixmap<uint16_t>& src)
+{
+  blurDirectionalGaussian5x1Lines(dst, dirmap, src);
+}
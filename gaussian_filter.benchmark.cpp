@@ -0,0 +1,769 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+  Benchmark of the kernels over pixel types, resolutions, bands and thread counts.
+  Build it in the mode to be measured:
+
+  g++ -O3 -fopenmp -I. gaussian_filter.benchmark.cpp -o gfbench
+  g++ -O3 -fopenmp -I. -DUSE_SIMD -mavx2 -mfma gaussian_filter.benchmark.cpp -o gfbench
+  g++ -O3 -fopenmp -I. -DUSE_SIMD_DISPATCH -c gaussian_filter.benchmark.cpp
+  g++ -fopenmp -o gfbench gfd2.o gfd5.o gfd8.o gfd9.o gaussian_filter.benchmark.o
+
+  ./gfbench --kernels=3x3,dir3x1 --types=u8,u16 --sizes=fhd,4k --bands=1,3 --threads=1,8 --format=json
+  ./gfbench --verify --types=u8,s16
+  ./gfbench --help
+
+  Every result is a row of the CSV (or an object of the JSON array) so that two runs can be diffed.
+  Time is wall clock over all threads, cycles are time stamp counter ticks, GB/s counts the
+  least traffic the kernel has to make (every plane it reads or writes, once). Megapixels and
+  cycles per pixel count width x height, a pixel with all of its bands.
+
+  --verify runs every kernel on test images of odd sizes instead and compares the output with a
+  double precision reference (gaussian_filter.verify.hpp); the directional kernels also have to
+  match their scalar references bit for bit, and every test image of u8, u16 and f32 has to come
+  back unchanged from a PGM/PPM or PFM file. The exit code is 1 when an error is above the
+  tolerance of the kernel.
+*/
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+#endif
+#if defined(_OPENMP)
+# include <omp.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+# include <unistd.h>
+#endif
+
+#include <cpixmap.hpp>
+#include <cnetpbm.hpp>
+#include <gaussian_filter.hpp>
+#include "gaussian_filter.verify.hpp"
+
+typedef enum {
+  KERNEL_3X3 = 0,
+  KERNEL_DIR3X1 = 1,   // directional 3x1 through a dirmap
+  KERNEL_FUSED3X1 = 2, // directional 3x1 in one sweep
+  KERNEL_DIR5X1 = 3,
+  KERNEL_GAUSSIAN = 4, // separable, sigma 2
+  KERNEL_TILED = 5,    // the same, tile by tile
+  KERNEL_PACKED3X3 = 6, // 3x3 on the bands packed into the channels of each pixel
+  KERNEL_RECURSIVE = 7, // Young & van Vliet, sigma 2
+  KERNEL_BOX = 8,       // three box passes, sigma 2
+  KERNEL_SCANLINE = 9,  // blurGaussian row by row through cscanlinegaussian
+  NR_KERNEL = 10
+} kernel_t;
+
+static const char *kernelNames[NR_KERNEL] = { "3x3", "dir3x1", "fused3x1", "dir5x1", "gaussian", "tiled", "packed3x3",
+					     "recursive", "box", "scanline" };
+// rows of --verify holding the directional kernels to their scalar references, bit for bit
+static const char *exactKernelNames[NR_KERNEL] = { NULL, "dir3x1/scalar", "fused3x1/scalar", "dir5x1/scalar", NULL, NULL, NULL,
+						  NULL, NULL, NULL };
+
+typedef enum {
+  TYPE_U8 = 0,
+  TYPE_S8 = 1,
+  TYPE_U16 = 2,
+  TYPE_S16 = 3,
+  TYPE_U32 = 4,
+  TYPE_S32 = 5,
+  TYPE_F32 = 6,
+  TYPE_F64 = 7,
+  TYPE_F16 = 8,
+  NR_TYPE = 9
+} type_t;
+
+static const char *typeNames[NR_TYPE] = { "u8", "s8", "u16", "s16", "u32", "s32", "f32", "f64", "f16" };
+
+typedef struct {
+  const char *name;
+  size_t width, height;
+} resolution_t;
+
+static const resolution_t resolutions[] = {
+  { "vga", 640, 480 }, { "hd", 1280, 720 }, { "fhd", 1920, 1080 }, { "4k", 3840, 2160 }, { "8k", 7680, 4320 }
+};
+
+typedef struct {
+  std::vector<int> kernels, types;
+  std::vector<resolution_t> sizes;
+  std::vector<size_t> bands;
+  std::vector<int> threads;
+  std::vector<std::string> isas;
+  size_t repeat, warmup;
+  bool json, verify;
+  const char *output;
+} options_t;
+
+typedef struct {
+  double median, p99, min; // seconds
+  double cycles; // per run, median
+} timing_t;
+
+// the kernels each pixel type can run, the rest report nothing
+template <typename T> bool blur3x3(cpixmap<T>& dst, cpixmap<T>& src) { blurGaussian3x3Kernel(dst, src); return true; }
+template <typename T> bool blurPacked3x3(cpackedpixmap<T>& dst, cpackedpixmap<T>& src) { blurGaussian3x3Kernel(dst, src); return true; }
+
+template <typename T> bool blurDirectional3x1(cpixmap<T>&, cpixmap<uint8_t>&, cpixmap<T>&) { return false; }
+template <typename T> bool blurFused3x1(cpixmap<T>&, cpixmap<T>&) { return false; }
+template <typename T> bool blurDirectional5x1(cpixmap<T>&, cpixmap<uint8_t>&, cpixmap<T>&) { return false; }
+template <typename T> bool blurDirectionalReference(int, cpixmap<T>&, cpixmap<uint8_t>&, cpixmap<T>&) { return false; }
+#define DIRECTIONAL_TYPE(T)						\
+  template <> bool blurDirectional3x1<T>(cpixmap<T>& dst, cpixmap<uint8_t>& dirmap, cpixmap<T>& src) \
+  { blurDirectionalGaussian3x1Kernel(dst, dirmap, src); return true; } \
+  template <> bool blurFused3x1<T>(cpixmap<T>& dst, cpixmap<T>& src)	\
+  { blurDirectionalGaussian3x1Kernel(dst, src); return true; }		\
+  template <> bool blurDirectional5x1<T>(cpixmap<T>& dst, cpixmap<uint8_t>& dirmap, cpixmap<T>& src) \
+  { blurDirectionalGaussian5x1Kernel(dst, dirmap, src); return true; } \
+  template <> bool blurDirectionalReference<T>(int kernel, cpixmap<T>& dst, cpixmap<uint8_t>& dirmap, cpixmap<T>& src) \
+  {									\
+    switch (kernel) {							\
+    case KERNEL_DIR3X1: blurDirectionalGaussian3x1KernelReference(dst, dirmap, src); return true; \
+    case KERNEL_FUSED3X1: blurDirectionalGaussian3x1KernelReference(dst, src); return true; \
+    case KERNEL_DIR5X1: blurDirectionalGaussian5x1KernelReference(dst, dirmap, src); return true; \
+    default: return false;						\
+    }									\
+  }
+DIRECTIONAL_TYPE(uint8_t)
+DIRECTIONAL_TYPE(uint16_t)
+#undef DIRECTIONAL_TYPE
+
+// each band streamed through cscanlinegaussian, rows pushed in and the last ones flushed out
+template <typename T>
+void blurScanline(cpixmap<T>& dst, cpixmap<T>& src, double sigmaX, double sigmaY)
+{
+  for (size_t z = 0; z < src.getBands(); ++z) {
+    cscanlinegaussian<T> stream(src.getWidth(), sigmaX, sigmaY);
+    size_t y = 0;
+    for (size_t row = 0; row < src.getHeight(); ++row)
+      if (stream.push(src.getLine(row, z), dst.getLine(y, z))) ++y;
+    while (y < src.getHeight() && stream.flush(dst.getLine(y, z))) ++y;
+    assert(y == src.getHeight());
+  }
+}
+
+// the packed kernel runs on packed copies of src and dst, see packImages
+template <typename T>
+bool runKernel(int kernel, cpixmap<T>& dst, cpixmap<uint8_t>& dirmap, cpixmap<T>& src,
+	       cpackedpixmap<T>& packedDst, cpackedpixmap<T>& packedSrc)
+{
+  switch (kernel) {
+  case KERNEL_3X3: return blur3x3(dst, src);
+  case KERNEL_DIR3X1: return blurDirectional3x1(dst, dirmap, src);
+  case KERNEL_FUSED3X1: return blurFused3x1(dst, src);
+  case KERNEL_DIR5X1: return blurDirectional5x1(dst, dirmap, src);
+  case KERNEL_GAUSSIAN: blurGaussian(dst, src, 2.0, 2.0); return true;
+  case KERNEL_TILED: blurGaussianTiled(dst, src, 2.0, 2.0); return true;
+  case KERNEL_PACKED3X3: return blurPacked3x3(packedDst, packedSrc);
+  case KERNEL_RECURSIVE: blurRecursiveGaussian(dst, src, 2.0, 2.0); return true;
+  case KERNEL_BOX: blurBoxGaussian(dst, src, 2.0); return true;
+  case KERNEL_SCANLINE: blurScanline(dst, src, 2.0, 2.0); return true;
+  default: abort(); break;
+  }
+  return false;
+}
+
+template <typename T>
+void packImages(cpackedpixmap<T>& packedDst, cpackedpixmap<T>& packedSrc, const cpixmap<T>& src)
+{
+  packPixmap(packedSrc, src);
+  packedDst.setResolution(src.getWidth(), src.getHeight(), src.getBands());
+}
+
+// bytes per sample the kernel has to move at the least
+inline double getTraffic(int kernel, size_t depth)
+{
+  switch (kernel) {
+  case KERNEL_DIR3X1:
+  case KERNEL_DIR5X1: return 3.0*depth + 2.0; // src read by both sweeps, dirmap written and read
+  case KERNEL_GAUSSIAN:
+  case KERNEL_RECURSIVE: return 2.0*depth + 8.0; // through a float plane
+  case KERNEL_BOX: return 2.0*depth + 16.0; // through two
+  default: return 2.0*depth;
+  }
+}
+
+inline uint64_t readCycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// edges and ramps with noise so that the directional kernels see every direction
+template <typename T>
+void fillBenchmarkImage(cpixmap<T>& image)
+{
+  const double range = std::numeric_limits<T>::is_integer ?
+    std::min(255.0, (double)std::numeric_limits<T>::max()) : 255.0;
+  uint32_t seed = 0x12345678u;
+  for (size_t z = 0; z < image.getBands(); ++z) {
+    for (size_t y = 0; y < image.getHeight(); ++y) {
+      T *line = image.getLine(y, z);
+      for (size_t x = 0; x < image.getWidth(); ++x) {
+	seed = seed * 1664525u + 1013904223u;
+	double v = ((x/16 + y/16 + z) & 1) ? 0.75*range : 0.25*range;
+	v += ((double)(x % 64) - 32.0) * range / 256.0 + (double)(seed >> 28) - 8.0;
+	line[x] = (T)std::max(0.0, std::min(range, v));
+      }
+    }
+  }
+}
+
+template <typename T>
+timing_t timeKernel(int kernel, cpixmap<T>& dst, cpixmap<uint8_t>& dirmap, cpixmap<T>& src,
+		    cpackedpixmap<T>& packedDst, cpackedpixmap<T>& packedSrc, const options_t& options)
+{
+  for (size_t i = 0; i < options.warmup; ++i) runKernel(kernel, dst, dirmap, src, packedDst, packedSrc);
+
+  std::vector<double> seconds(options.repeat), cycles(options.repeat);
+  for (size_t i = 0; i < options.repeat; ++i) {
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    uint64_t c0 = readCycles();
+    runKernel(kernel, dst, dirmap, src, packedDst, packedSrc);
+    uint64_t c1 = readCycles();
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    seconds[i] = std::chrono::duration<double>(t1 - t0).count();
+    cycles[i] = (double)(c1 - c0);
+  }
+  std::sort(seconds.begin(), seconds.end());
+  std::sort(cycles.begin(), cycles.end());
+
+  timing_t timing;
+  const size_t n = options.repeat;
+  timing.median = (n & 1) ? seconds[n>>1] : 0.5 * (seconds[(n>>1)-1] + seconds[n>>1]);
+  timing.p99 = seconds[std::min(n-1, (size_t)std::ceil(0.99 * (double)n) - 1)]; // nearest rank
+  timing.min = seconds[0];
+  timing.cycles = (n & 1) ? cycles[n>>1] : 0.5 * (cycles[(n>>1)-1] + cycles[n>>1]);
+  return timing;
+}
+
+class cresultwriter {
+public:
+  cresultwriter(FILE *file, bool json, bool verify) : m_file(file), m_json(json), m_verify(verify), m_rows(0) {}
+  void begin(void)
+  {
+    if (m_json) fprintf(m_file, "[\n");
+    else if (m_verify) fprintf(m_file, "kernel,type,isa,image,width,height,bands,max_error,mean_error,tolerance,result\n");
+    else fprintf(m_file, "kernel,type,isa,width,height,bands,threads,runs,median_ms,p99_ms,min_ms,mpix_s,gb_s,cycles_per_pixel\n");
+  }
+  void write(const char *kernel, const char *type, const char *isa, size_t width, size_t height, size_t bands,
+	     int threads, size_t runs, const timing_t& timing, double bytes)
+  {
+    // a pixel is all of its bands, so the rates compare across band counts
+    const double pixels = (double)width * (double)height;
+    const double mpix = pixels / timing.median * 1e-6;
+    const double gbs = bytes / timing.median * 1e-9;
+    const double cpp = timing.cycles / pixels;
+    if (m_json) {
+      fprintf(m_file, "%s  {\"kernel\": \"%s\", \"type\": \"%s\", \"isa\": \"%s\", \"width\": %zu, \"height\": %zu, "
+	      "\"bands\": %zu, \"threads\": %d, \"runs\": %zu, \"median_ms\": %.4f, \"p99_ms\": %.4f, \"min_ms\": %.4f, "
+	      "\"mpix_s\": %.2f, \"gb_s\": %.3f, \"cycles_per_pixel\": %.3f}",
+	      m_rows ? ",\n" : "", kernel, type, isa, width, height, bands, threads, runs,
+	      timing.median * 1e3, timing.p99 * 1e3, timing.min * 1e3, mpix, gbs, cpp);
+    } else {
+      fprintf(m_file, "%s,%s,%s,%zu,%zu,%zu,%d,%zu,%.4f,%.4f,%.4f,%.2f,%.3f,%.3f\n",
+	      kernel, type, isa, width, height, bands, threads, runs,
+	      timing.median * 1e3, timing.p99 * 1e3, timing.min * 1e3, mpix, gbs, cpp);
+    }
+    fflush(m_file);
+    m_rows++;
+  }
+  void write(const char *kernel, const char *type, const char *isa, const char *image, size_t width, size_t height,
+	     size_t bands, const error_stats_t& error, double tolerance, bool pass)
+  {
+    if (m_json) {
+      fprintf(m_file, "%s  {\"kernel\": \"%s\", \"type\": \"%s\", \"isa\": \"%s\", \"image\": \"%s\", \"width\": %zu, "
+	      "\"height\": %zu, \"bands\": %zu, \"max_error\": %.6g, \"mean_error\": %.6g, \"tolerance\": %.6g, \"result\": \"%s\"}",
+	      m_rows ? ",\n" : "", kernel, type, isa, image, width, height, bands, error.max, error.mean, tolerance,
+	      pass ? "pass" : "FAIL");
+    } else {
+      fprintf(m_file, "%s,%s,%s,%s,%zu,%zu,%zu,%.6g,%.6g,%.6g,%s\n", kernel, type, isa, image, width, height, bands,
+	      error.max, error.mean, tolerance, pass ? "pass" : "FAIL");
+    }
+    fflush(m_file);
+    m_rows++;
+  }
+  void end(void)
+  {
+    if (m_json) fprintf(m_file, "%s]\n", m_rows ? "\n" : "");
+  }
+private:
+  FILE *m_file;
+  bool m_json, m_verify;
+  size_t m_rows;
+};
+
+inline void setThreads(int threads)
+{
+#if defined(_OPENMP)
+  omp_set_num_threads(threads);
+#else
+  (void)threads;
+#endif
+}
+
+// name of the code the kernels run, "all" lists the variants of the dispatcher
+inline std::vector<std::string> getIsaNames(const std::vector<std::string>& wanted)
+{
+  std::vector<std::string> names;
+#if defined(USE_SIMD_DISPATCH)
+  static const char *variants[] = { "SSE2", "SSE4.1", "AVX2", "AVX512BW" };
+  for (size_t i = 0; i < wanted.size(); ++i) {
+    if (wanted[i] == "all") {
+      for (size_t j = 0; j < 4; ++j)
+	if (setGaussianDispatch(variants[j])) names.push_back(variants[j]);
+    } else if (setGaussianDispatch(wanted[i].c_str())) names.push_back(wanted[i]);
+    else fprintf(stderr, "Warning: %s is not available here\n", wanted[i].c_str());
+  }
+  setGaussianDispatch(NULL);
+#else
+  (void)wanted;
+# if !defined(USE_SIMD)
+  names.push_back("scalar");
+# elif INSTRSET >= 9
+  names.push_back("AVX512BW");
+# elif INSTRSET >= 8
+  names.push_back("AVX2");
+# elif INSTRSET >= 5
+  names.push_back("SSE4.1");
+# else
+  names.push_back("SSE2");
+# endif
+#endif
+  return names;
+}
+
+template <typename T>
+void benchmarkType(int type, const options_t& options, cresultwriter& writer)
+{
+  const std::vector<std::string> isas = getIsaNames(options.isas);
+  for (size_t s = 0; s < options.sizes.size(); ++s) {
+    for (size_t b = 0; b < options.bands.size(); ++b) {
+      const resolution_t& size = options.sizes[s];
+      cpixmap<T> src(size.width, size.height, options.bands[b]), dst(size.width, size.height, options.bands[b]);
+      cpixmap<uint8_t> dirmap(size.width, size.height, options.bands[b]);
+      cpackedpixmap<T> packedSrc, packedDst;
+      fillBenchmarkImage(src);
+      packImages(packedDst, packedSrc, src);
+
+      for (size_t k = 0; k < options.kernels.size(); ++k) {
+	const int kernel = options.kernels[k];
+	// a first run tells whether the type has the kernel and touches the planes
+	if (!runKernel(kernel, dst, dirmap, src, packedDst, packedSrc)) continue;
+	const double bytes = getTraffic(kernel, sizeof(T)) * (double)size.width * (double)size.height * (double)options.bands[b];
+
+	for (size_t i = 0; i < isas.size(); ++i) {
+#if defined(USE_SIMD_DISPATCH)
+	  setGaussianDispatch(isas[i].c_str());
+#endif
+	  for (size_t t = 0; t < options.threads.size(); ++t) {
+	    setThreads(options.threads[t]);
+	    timing_t timing = timeKernel(kernel, dst, dirmap, src, packedDst, packedSrc, options);
+	    writer.write(kernelNames[kernel], typeNames[type], isas[i].c_str(), size.width, size.height,
+			 options.bands[b], options.threads[t], options.repeat, timing, bytes);
+	  }
+	}
+#if defined(USE_SIMD_DISPATCH)
+	setGaussianDispatch(NULL);
+#endif
+      }
+    }
+  }
+}
+
+// largest error of storing an exact result in the pixel type
+template <typename T> inline double getStorageError(void) { return std::numeric_limits<T>::is_integer ? 0.5 : 0.0; }
+template <> inline double getStorageError<half_t>(void) { return getTestMax<half_t>() / 2048.0; } // half an ulp of 11 bits
+
+// Bound of the error of a separable approximation whose 1-D taps are off the gaussian by up to
+// deviation over taps taps: the 2-D kernels are at most 2 * taps * deviation apart in L1 (both
+// sum to one), and so are the outputs in units of the range of the image.
+inline double getSeparableBound(double deviation, size_t taps) { return 2.0 * (double)taps * deviation; }
+
+// taps getRecursiveGaussianDeviation compares
+inline size_t getRecursiveGaussianTaps(double sigma) { return (getGaussianRadius(sigma)<<2) + 1; }
+
+// support of the box cascade or of the gaussian, whichever is wider
+inline size_t getBoxGaussianTaps(double sigma, size_t passes)
+{
+  std::vector<size_t> widths;
+  getBoxGaussianWidths(widths, sigma, passes);
+  size_t taps = 1;
+  for (size_t i = 0; i < widths.size(); ++i) taps += widths[i] - 1;
+  return std::max(taps, (getGaussianRadius(sigma)<<1) + 1);
+}
+
+// largest error a kernel may make against the double reference
+template <typename T>
+double getTolerance(int kernel)
+{
+  switch (kernel) {
+  case KERNEL_PACKED3X3:
+  case KERNEL_3X3:
+    // floating point weights of 1/16 and its multiples, rounded in the sums only
+    if (!std::numeric_limits<T>::is_integer) return getStorageError<T>() + (getTestMax<T>() - getTestMin<T>()) * 1e-6;
+    if (kernel == KERNEL_PACKED3X3) return 0.5; // exact sums everywhere
+#if defined(USE_SIMD) || defined(USE_SIMD_DISPATCH)
+    // only the 8 and 16-bit unsigned kernels round once, the others add up 9 truncated shifts
+    if (sizeof(T) > 2 || std::numeric_limits<T>::is_signed) return 8.5;
+#endif
+    return 0.5;
+  case KERNEL_DIR3X1:
+  case KERNEL_FUSED3X1: return 2.0; // three truncated shifts
+  case KERNEL_DIR5X1: return 5.0; // six
+  case KERNEL_GAUSSIAN:
+  case KERNEL_TILED: // float sums, rounded once
+    return getStorageError<T>() + (getTestMax<T>() - getTestMin<T>()) * 1e-5;
+  case KERNEL_RECURSIVE: // approximations of the gaussian, on top of the float sums
+    return getStorageError<T>() + (getTestMax<T>() - getTestMin<T>()) *
+      (getSeparableBound(getRecursiveGaussianDeviation(2.0), getRecursiveGaussianTaps(2.0)) + 1e-5);
+  case KERNEL_BOX:
+    return getStorageError<T>() + (getTestMax<T>() - getTestMin<T>()) *
+      (getSeparableBound(getBoxGaussianDeviation(2.0, 3), getBoxGaussianTaps(2.0, 3)) + 1e-5);
+  case KERNEL_SCANLINE: return 0.0; // the same bits as blurGaussian
+  default: abort(); break;
+  }
+  return 0.0;
+}
+
+template <typename T>
+void copyToDouble(cpixmap<double>& ref, cpixmap<T>& pixmap)
+{
+  ref.setResolution(pixmap.getWidth(), pixmap.getHeight(), pixmap.getBands(), false);
+  for (size_t z = 0; z < pixmap.getBands(); ++z)
+    for (size_t y = 0; y < pixmap.getHeight(); ++y)
+      for (size_t x = 0; x < pixmap.getWidth(); ++x) ref.getLine(y, z)[x] = (double)pixmap.getPixel(x, y, z);
+}
+
+// the scanline stream is held to blurGaussian itself, bit for bit
+template <typename T>
+void blurReference(int kernel, cpixmap<double>& ref, cpixmap<T>& src)
+{
+  switch (kernel) {
+  case KERNEL_3X3:
+  case KERNEL_PACKED3X3: blurGaussian3x3Double(ref, src); break;
+  case KERNEL_DIR3X1:
+  case KERNEL_FUSED3X1: blurDirectionalGaussian3x1Double(ref, src); break;
+  case KERNEL_DIR5X1: blurDirectionalGaussian5x1Double(ref, src); break;
+  case KERNEL_GAUSSIAN:
+  case KERNEL_TILED:
+  case KERNEL_RECURSIVE:
+  case KERNEL_BOX: blurGaussianDouble(ref, src, 2.0, 2.0); break;
+  case KERNEL_SCANLINE: {
+    cpixmap<T> expected(src.getWidth(), src.getHeight(), src.getBands());
+    blurGaussian(expected, src, 2.0, 2.0);
+    copyToDouble(ref, expected);
+    break;
+  }
+  default: abort(); break;
+  }
+}
+
+// widths around every vector length and its tail, heights around the strips
+static const resolution_t verifySizes[] = {
+  { "1x1", 1, 1 }, { "2x3", 2, 3 }, { "7x5", 7, 5 }, { "33x17", 33, 17 }, { "67x9", 67, 9 }, { "130x6", 130, 6 }, { "257x4", 257, 4 }
+};
+
+// a scratch file for the round trips, empty if none could be made
+static std::string getScratchPath(void)
+{
+#if defined(__unix__) || defined(__APPLE__)
+  char path[] = "/tmp/gfbench-XXXXXX";
+  const int fd = mkstemp(path);
+  if (fd < 0) return std::string();
+  close(fd);
+  return path;
+#else
+  return "gfbench-verify.pnm";
+#endif
+}
+
+// every test image written as PGM/PPM or PFM and read back, bit for bit, for the types those store
+template <typename T> bool isNetpbmType(void) { return false; }
+template <> bool isNetpbmType<uint8_t>(void) { return true; }
+template <> bool isNetpbmType<uint16_t>(void) { return true; }
+template <> bool isNetpbmType<float>(void) { return true; }
+
+template <typename T>
+bool verifyNetpbm(int type, const options_t& options, cresultwriter& writer)
+{
+  if (!isNetpbmType<T>()) return true;
+#if defined(USE_SIMD_DISPATCH)
+  (void)options;
+  const std::string isa = "scalar"; // cnetpbm is not dispatched
+#else
+  const std::string isa = getIsaNames(options.isas)[0];
+#endif
+  const std::string path = getScratchPath();
+  if (path.empty()) {
+    fprintf(stderr, "Error: no scratch file for the netpbm round trips\n");
+    return false;
+  }
+  static const size_t bands[] = { 1, 3 };
+  bool pass = true;
+  for (size_t s = 0; s < sizeof(verifySizes) / sizeof(verifySizes[0]); ++s) {
+    const resolution_t& size = verifySizes[s];
+    for (size_t b = 0; b < sizeof(bands) / sizeof(bands[0]); ++b) {
+      cpixmap<T> src(size.width, size.height, bands[b]), back;
+      cpixmap<double> ref;
+      for (int image = 0; image < NR_TEST_IMAGE; ++image) {
+	fillTestImage(src, (test_image_t)image, (uint32_t)(s + 1));
+	cnetpbmwriter out;
+	cnetpbmreader in;
+	bool ok = out.open<T>(path.c_str(), size.width, size.height, bands[b]) && out.write(src) && out.close() &&
+	  in.open(path.c_str()) && in.read(back) && back.isMatched(src);
+	error_stats_t error = { 0.0, 0.0, 0, 0, 0 };
+	if (ok) {
+	  copyToDouble(ref, src);
+	  error = measureError(back, ref);
+	  ok = error.max == 0.0;
+	}
+	writer.write("netpbm", typeNames[type], isa.c_str(), testImageNames[image],
+		     size.width, size.height, bands[b], error, 0.0, ok);
+	pass = pass && ok;
+      }
+    }
+  }
+  remove(path.c_str());
+  return pass;
+}
+
+template <typename T>
+bool verifyType(int type, const options_t& options, cresultwriter& writer)
+{
+  const std::vector<std::string> isas = getIsaNames(options.isas);
+  const size_t bands = 2;
+  bool pass = true;
+  for (size_t s = 0; s < sizeof(verifySizes) / sizeof(verifySizes[0]); ++s) {
+    const resolution_t& size = verifySizes[s];
+    cpixmap<T> src(size.width, size.height, bands), dst(size.width, size.height, bands);
+    cpixmap<T> expected(size.width, size.height, bands);
+    cpixmap<uint8_t> dirmap(size.width, size.height, bands);
+    cpackedpixmap<T> packedSrc, packedDst;
+    cpixmap<double> ref, exactRef;
+
+    for (int image = 0; image < NR_TEST_IMAGE; ++image) {
+      fillTestImage(src, (test_image_t)image, (uint32_t)(s + 1));
+      packImages(packedDst, packedSrc, src);
+      for (size_t k = 0; k < options.kernels.size(); ++k) {
+	const int kernel = options.kernels[k];
+	if (!runKernel(kernel, dst, dirmap, src, packedDst, packedSrc)) continue; // not for this type
+	blurReference(kernel, ref, src);
+	const double tolerance = getTolerance<T>(kernel);
+	const bool exact = blurDirectionalReference(kernel, expected, dirmap, src);
+	if (exact) copyToDouble(exactRef, expected);
+
+	for (size_t i = 0; i < isas.size(); ++i) {
+#if defined(USE_SIMD_DISPATCH)
+	  setGaussianDispatch(isas[i].c_str());
+#endif
+	  runKernel(kernel, dst, dirmap, src, packedDst, packedSrc);
+	  if (kernel == KERNEL_PACKED3X3) unpackPixmap(dst, packedDst);
+	  error_stats_t error = measureError(dst, ref);
+	  const bool ok = (kernel == KERNEL_SCANLINE) ? error.max == 0.0 : error.max <= tolerance + 1e-9;
+	  writer.write(kernelNames[kernel], typeNames[type], isas[i].c_str(), testImageNames[image],
+		       size.width, size.height, bands, error, tolerance, ok);
+	  pass = pass && ok;
+	  if (exact) {
+	    error = measureError(dst, exactRef);
+	    const bool same = error.max == 0.0;
+	    writer.write(exactKernelNames[kernel], typeNames[type], isas[i].c_str(), testImageNames[image],
+			 size.width, size.height, bands, error, 0.0, same);
+	    pass = pass && same;
+	  }
+	}
+#if defined(USE_SIMD_DISPATCH)
+	setGaussianDispatch(NULL);
+#endif
+      }
+    }
+  }
+  return pass;
+}
+
+template <typename T>
+bool runType(int type, const options_t& options, cresultwriter& writer)
+{
+  if (options.verify) {
+    const bool pass = verifyType<T>(type, options, writer);
+    return verifyNetpbm<T>(type, options, writer) && pass;
+  }
+  benchmarkType<T>(type, options, writer);
+  return true;
+}
+
+static std::vector<std::string> splitList(const char *list)
+{
+  std::vector<std::string> items;
+  std::string item;
+  for (const char *p = list; ; ++p) {
+    if (*p == ',' || *p == '\0') {
+      if (!item.empty()) items.push_back(item);
+      item.clear();
+      if (*p == '\0') break;
+    } else item += *p;
+  }
+  return items;
+}
+
+static int findName(const std::string& name, const char *const *names, int count)
+{
+  for (int i = 0; i < count; ++i)
+    if (name == names[i]) return i;
+  return -1;
+}
+
+static void printUsage(const char *program)
+{
+  fprintf(stderr,
+	  "usage: %s [options]\n"
+	  "  --kernels=LIST  3x3,dir3x1,fused3x1,dir5x1,gaussian,tiled,packed3x3,\n"
+	  "                  recursive,box,scanline or all (default 3x3,dir3x1)\n"
+	  "  --types=LIST    u8,s8,u16,s16,u32,s32,f32,f64,f16 or all (default all)\n"
+	  "  --sizes=LIST    vga,hd,fhd,4k,8k, WxH or all (default all)\n"
+	  "  --bands=LIST    band counts (default 1,3,4)\n"
+	  "  --threads=LIST  thread counts (default 1 and every thread)\n"
+	  "  --isa=LIST      SSE2,SSE4.1,AVX2,AVX512BW or all, only with USE_SIMD_DISPATCH (default all)\n"
+	  "  --repeat=N      timed runs per result (default 15)\n"
+	  "  --warmup=N      untimed runs before (default 2)\n"
+	  "  --format=F      csv or json (default csv)\n"
+	  "  --output=FILE   instead of stdout\n"
+	  "  --verify        error against the double reference instead of timing (kernels default to all)\n", program);
+}
+
+static bool parseOptions(int argc, char **argv, options_t& options)
+{
+  const char *kernels = NULL, *types = "all", *sizes = "all", *bands = "1,3,4", *threads = NULL, *isas = "all";
+  options.repeat = 15, options.warmup = 2, options.json = false, options.verify = false, options.output = NULL;
+
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (!strcmp(arg, "--verify")) {
+      options.verify = true;
+      continue;
+    }
+    const char *value = strchr(arg, '=');
+    if (strncmp(arg, "--", 2) || !value) return false;
+    std::string key(arg + 2, value++ - arg - 2);
+    if (key == "kernels") kernels = value;
+    else if (key == "types") types = value;
+    else if (key == "sizes") sizes = value;
+    else if (key == "bands") bands = value;
+    else if (key == "threads") threads = value;
+    else if (key == "isa") isas = value;
+    else if (key == "repeat") options.repeat = (size_t)atoi(value);
+    else if (key == "warmup") options.warmup = (size_t)atoi(value);
+    else if (key == "format") options.json = !strcmp(value, "json");
+    else if (key == "output") options.output = value;
+    else return false;
+  }
+  if (options.repeat == 0) return false;
+  if (!kernels) kernels = options.verify ? "all" : "3x3,dir3x1";
+
+  std::vector<std::string> list = splitList(kernels);
+  for (size_t i = 0; i < list.size(); ++i) {
+    if (list[i] == "all") for (int k = 0; k < NR_KERNEL; ++k) options.kernels.push_back(k);
+    else if (findName(list[i], kernelNames, NR_KERNEL) >= 0) options.kernels.push_back(findName(list[i], kernelNames, NR_KERNEL));
+    else return false;
+  }
+  list = splitList(types);
+  for (size_t i = 0; i < list.size(); ++i) {
+    if (list[i] == "all") for (int t = 0; t < NR_TYPE; ++t) options.types.push_back(t);
+    else if (findName(list[i], typeNames, NR_TYPE) >= 0) options.types.push_back(findName(list[i], typeNames, NR_TYPE));
+    else return false;
+  }
+  list = splitList(sizes);
+  for (size_t i = 0; i < list.size(); ++i) {
+    const size_t count = sizeof(resolutions) / sizeof(resolutions[0]);
+    bool found = false;
+    for (size_t r = 0; r < count; ++r) {
+      if (list[i] == "all" || list[i] == resolutions[r].name) options.sizes.push_back(resolutions[r]), found = true;
+    }
+    unsigned long w, h;
+    if (!found && sscanf(list[i].c_str(), "%lux%lu", &w, &h) == 2 && w > 0 && h > 0) {
+      resolution_t custom = { "custom", (size_t)w, (size_t)h };
+      options.sizes.push_back(custom), found = true;
+    }
+    if (!found) return false;
+  }
+  list = splitList(bands);
+  for (size_t i = 0; i < list.size(); ++i) {
+    if (atoi(list[i].c_str()) <= 0) return false;
+    options.bands.push_back((size_t)atoi(list[i].c_str()));
+  }
+  if (threads) {
+    list = splitList(threads);
+    for (size_t i = 0; i < list.size(); ++i) {
+      if (atoi(list[i].c_str()) <= 0) return false;
+      options.threads.push_back(atoi(list[i].c_str()));
+    }
+  } else {
+    options.threads.push_back(1);
+#if defined(_OPENMP)
+    if (omp_get_max_threads() > 1) options.threads.push_back(omp_get_max_threads());
+#endif
+  }
+  options.isas = splitList(isas);
+  return !options.kernels.empty() && !options.types.empty() && !options.sizes.empty() && !options.bands.empty();
+}
+
+int main(int argc, char **argv)
+{
+  options_t options;
+  if (!parseOptions(argc, argv, options)) {
+    printUsage(argv[0]);
+    return 1;
+  }
+  FILE *file = options.output ? fopen(options.output, "w") : stdout;
+  if (!file) {
+    fprintf(stderr, "Error: can not write %s\n", options.output);
+    return 1;
+  }
+
+  cresultwriter writer(file, options.json, options.verify);
+  writer.begin();
+  bool pass = true;
+  for (size_t i = 0; i < options.types.size(); ++i) {
+    switch (options.types[i]) {
+    case TYPE_U8: pass = runType<uint8_t>(TYPE_U8, options, writer) && pass; break;
+    case TYPE_S8: pass = runType<int8_t>(TYPE_S8, options, writer) && pass; break;
+    case TYPE_U16: pass = runType<uint16_t>(TYPE_U16, options, writer) && pass; break;
+    case TYPE_S16: pass = runType<int16_t>(TYPE_S16, options, writer) && pass; break;
+    case TYPE_U32: pass = runType<uint32_t>(TYPE_U32, options, writer) && pass; break;
+    case TYPE_S32: pass = runType<int32_t>(TYPE_S32, options, writer) && pass; break;
+    case TYPE_F32: pass = runType<float>(TYPE_F32, options, writer) && pass; break;
+    case TYPE_F64: pass = runType<double>(TYPE_F64, options, writer) && pass; break;
+    case TYPE_F16: pass = runType<half_t>(TYPE_F16, options, writer) && pass; break;
+    default: abort(); break;
+    }
+  }
+  writer.end();
+  if (file != stdout) fclose(file);
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdlib>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include <cchunk.hpp>
+
+// Per-pixel rules of the directional filters, shared by the scalar kernels
+// and by the scalar tails of the SIMD kernels so that both give the same bits.
+// The line pointers come from window frames: [-1] and [len] are padding.
+
+typedef enum {
+  UNDIRECTIONAL = 0,
+  HORIZONTAL = 1,
+  VERTICAL = 2,
+  DIAGONAL1 = 3,
+  DIAGONAL2 = 4,
+  NR_DIRECTION = 5
+} direction_t;
+
+// direction of the largest scaled difference across the 3x3 neighbourhood, the horizontal and
+// vertical ones scaled by about 1.41 against the diagonals; the last of H, V, D1, D2 wins ties
+template <typename T>
+inline uint8_t getDirection3x1(const T *prev, const T *curr, const T *next, int x)
+{
+  int hDiff = std::abs((int)curr[x-1] - (int)curr[x+1]);
+  int hDir = hDiff + (hDiff>>2) + (hDiff>>3) + (hDiff>>5);
+
+  int vDiff = std::abs((int)prev[x] - (int)next[x]);
+  int vDir = vDiff + (vDiff>>2) + (vDiff>>3) + (vDiff>>5);
+
+  //int hDir = hDiff + (hDiff/4) + (hDiff/8) + (hDiff/32);
+  //int vDir = vDiff + (vDiff/4) + (vDiff/8) + (vDiff/32);
+  int d1Diff = std::abs((int)prev[x+1] - (int)next[x-1]);
+  int d2Diff = std::abs((int)prev[x-1] - (int)next[x+1]);
+
+  if (hDir > vDir) {
+    if (hDir > d1Diff) {
+      if (hDir > d2Diff) return HORIZONTAL; // H
+      else return DIAGONAL2; // D2
+    } else {
+      if (d1Diff > d2Diff) return DIAGONAL1; // D1
+      else return DIAGONAL2; // D2
+    }
+  } else {
+    if (vDir > d1Diff) {
+      if (vDir > d2Diff) return VERTICAL; // V
+      else return DIAGONAL2; // D2
+    } else {
+      if (d1Diff > d2Diff) return DIAGONAL1; // D1
+      else return DIAGONAL2; // D2
+    }
+  }
+}
+
+// majority of the 3x3 direction codes, ties broken the same way as above
+inline uint8_t voteDirection3x1(const uint8_t *prev, const uint8_t *curr, const uint8_t *next, int x)
+{
+  int dirCount[NR_DIRECTION] = {0,0,0,0,0};
+  dirCount[prev[x-1]]++, dirCount[prev[x]]++, dirCount[prev[x+1]]++;
+  dirCount[curr[x-1]]++, dirCount[curr[x]]++, dirCount[curr[x+1]]++;
+  dirCount[next[x-1]]++, dirCount[next[x]]++, dirCount[next[x+1]]++;
+
+  if (dirCount[HORIZONTAL] > dirCount[VERTICAL]) {
+    if (dirCount[HORIZONTAL] > dirCount[DIAGONAL1]) {
+      if (dirCount[HORIZONTAL] > dirCount[DIAGONAL2]) return HORIZONTAL;
+      else return DIAGONAL2;
+    } else {
+      if (dirCount[DIAGONAL1] > dirCount[DIAGONAL2]) return DIAGONAL1;
+      else return DIAGONAL2;
+    }
+  } else {
+    if (dirCount[VERTICAL] > dirCount[DIAGONAL1]) {
+      if (dirCount[VERTICAL] > dirCount[DIAGONAL2]) return VERTICAL;
+      else return DIAGONAL2;
+    } else {
+      if (dirCount[DIAGONAL1] > dirCount[DIAGONAL2]) return DIAGONAL1;
+      else return DIAGONAL2;
+    }
+  }
+}
+
+// 1-2-1 blur along the direction
+template <typename T>
+inline T blurDirection3x1(uint8_t dir, const T *prev, const T *curr, const T *next, int x)
+{
+  switch (dir) {
+  case HORIZONTAL:
+    return (curr[x-1]>>2) + (curr[x]>>1) + (curr[x+1]>>2);
+  case VERTICAL:
+    return (prev[x]>>2) + (curr[x]>>1) + (next[x]>>2);
+  case DIAGONAL1:
+    return (prev[x+1]>>2) + (curr[x]>>1) + (next[x-1]>>2);
+  case DIAGONAL2:
+    return (prev[x-1]>>2) + (curr[x]>>1) + (next[x+1]>>2);
+  default: abort(); break;
+  }
+  return 0;
+}
+
+// orientations of the 5x5 variant in steps of 22.5 degrees, counterclockwise from horizontal
+typedef enum {
+  ORIENTATION_0 = 0,
+  ORIENTATION_22 = 1,
+  ORIENTATION_45 = 2,
+  ORIENTATION_67 = 3,
+  ORIENTATION_90 = 4,
+  ORIENTATION_112 = 5,
+  ORIENTATION_135 = 6,
+  ORIENTATION_157 = 7,
+  NR_ORIENTATION = 8
+} orientation_t;
+
+// (dx, dy) of the taps one and two steps along each orientation (y grows downwards),
+// the taps on the other side are mirrored through the center
+const int orientationTaps[NR_ORIENTATION][4] = {
+  { 1, 0, 2, 0 }, { 1, 0, 2, -1 }, { 1, -1, 2, -2 }, { 0, -1, 1, -2 },
+  { 0, -1, 0, -2 }, { 0, -1, -1, -2 }, { -1, -1, -2, -2 }, { -1, 0, -2, -1 }
+};
+
+// difference between the outer taps scaled to the length of the diagonals,
+// sqrt(2) for the axes and sqrt(8/5) for the steps between
+inline int scaleOrientationDiff(int diff, int orientation)
+{
+  if ((orientation & 3) == 0) return diff + (diff>>2) + (diff>>3) + (diff>>5);
+  if (orientation & 1) return diff + (diff>>2) + (diff>>6);
+  return diff;
+}
+
+// orientation of the largest scaled difference, the first one wins ties;
+// lines are the five rows around the pixel, lines[2] is its own row
+template <typename T>
+inline uint8_t getDirection5x1(const T *const *lines, int x)
+{
+  uint8_t best = ORIENTATION_0;
+  int bestDiff = -1;
+  for (int i = ORIENTATION_0; i < NR_ORIENTATION; ++i) {
+    const int dx = orientationTaps[i][2], dy = orientationTaps[i][3];
+    int diff = scaleOrientationDiff(std::abs((int)lines[2+dy][x+dx] - (int)lines[2-dy][x-dx]), i);
+    if (diff > bestDiff) best = (uint8_t)i, bestDiff = diff;
+  }
+  return best;
+}
+
+// majority of the 3x3 orientation codes, the first one wins ties
+inline uint8_t voteDirection5x1(const uint8_t *prev, const uint8_t *curr, const uint8_t *next, int x)
+{
+  int count[NR_ORIENTATION] = {0,0,0,0,0,0,0,0};
+  count[prev[x-1]]++, count[prev[x]]++, count[prev[x+1]]++;
+  count[curr[x-1]]++, count[curr[x]]++, count[curr[x+1]]++;
+  count[next[x-1]]++, count[next[x]]++, count[next[x+1]]++;
+
+  uint8_t best = ORIENTATION_0;
+  for (int i = ORIENTATION_22; i < NR_ORIENTATION; ++i)
+    if (count[i] > count[best]) best = (uint8_t)i;
+  return best;
+}
+
+// 1-4-6-4-1 blur along the orientation, in shifts like the 3x1 blur
+template <typename T>
+inline T blurDirection5x1(uint8_t dir, const T *const *lines, int x)
+{
+  assert(dir < NR_ORIENTATION);
+  const int dx1 = orientationTaps[dir][0], dy1 = orientationTaps[dir][1];
+  const int dx2 = orientationTaps[dir][2], dy2 = orientationTaps[dir][3];
+  const T c = lines[2][x];
+  return (lines[2-dy2][x-dx2]>>4) + (lines[2-dy1][x-dx1]>>2) + (c>>2) + (c>>3) +
+    (lines[2+dy1][x+dx1]>>2) + (lines[2+dy2][x+dx2]>>4);
+}
+
+// Direction codes of the last few lines of a streaming sweep, so that the fused
+// kernels never write a dirmap. Line y lives in slot y % lines, its padding is
+// replicated like the border of a window frame over a dirmap.
+class cdirectionring {
+public:
+  cdirectionring(size_t width, size_t lines = 3, size_t padding = 1)
+    : m_width(width), m_lines(lines), m_padding(padding), m_stride(width + (padding<<1)), m_buffer(lines * m_stride) {}
+  uint8_t *getLine(int y) { return &m_buffer[(y % m_lines) * m_stride + m_padding]; }
+  // the line of codes of row y (mapped into [0, height) as the dirmap frame does)
+  uint8_t *getLine(int y, int height) { return getLine(mapBorder(y, height, BORDER_REPLICATE)); }
+  void fillLine(int y) { fillBorder(getLine(y), m_width, m_padding, BORDER_REPLICATE); }
+private:
+  size_t m_width, m_lines, m_padding, m_stride;
+  std::vector<uint8_t> m_buffer;
+};
@@ -0,0 +1,362 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+  Run-time dispatching of the SIMD kernels in gaussian_filter.SIMD.hpp.
+  Compile this file once per instruction set. Each object keeps the kernels and every class
+  they use (cpixmap, cchunk, the window frames, ...) in a namespace of its own, so that no
+  code compiled for one instruction set is shared with the others or with the application:
+
+  g++ -O3 -fopenmp -I. -msse2 -c gaussian_filter.dispatch.cpp -o gfd2.o
+  g++ -O3 -fopenmp -I. -msse4.1 -c gaussian_filter.dispatch.cpp -o gfd5.o
+  g++ -O3 -fopenmp -I. -mavx2 -mfma -mf16c -c gaussian_filter.dispatch.cpp -o gfd8.o
+  g++ -O3 -fopenmp -I. -mavx512bw -mavx512dq -mavx512vl -mfma -mf16c -c gaussian_filter.dispatch.cpp -o gfd9.o
+  g++ -O3 -fopenmp -I. -DUSE_SIMD_DISPATCH -c app.cpp
+  g++ -fopenmp -o app gfd2.o gfd5.o gfd8.o gfd9.o app.o
+*/
+#if !defined(__x86_64__) && !defined(__i386__)
+# error "Run-time dispatching is only for x86-SIMD!"
+#endif
+
+#if defined(__AVX512F__)
+# if !defined(__AVX512BW__)
+#  error "The AVX-512 variant needs -mavx512bw!"
+# endif
+# define VCL_NAMESPACE vcl_avx512bw
+# define GAUSSIAN_DISPATCH_NAMESPACE gaussian_avx512bw
+#elif defined(__AVX2__)
+# define VCL_NAMESPACE vcl_avx2
+# define GAUSSIAN_DISPATCH_NAMESPACE gaussian_avx2
+#elif defined(__SSE4_1__)
+# define VCL_NAMESPACE vcl_sse41
+# define GAUSSIAN_DISPATCH_NAMESPACE gaussian_sse41
+#else
+# define VCL_NAMESPACE vcl_sse2
+# define GAUSSIAN_DISPATCH_NAMESPACE gaussian_sse2
+#endif
+
+// the system headers stay global, the headers below include them again to no effect
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <map>
+#include <mutex>
+#if defined(_OPENMP)
+# include <omp.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+# include <unistd.h>
+#endif
+#define MAX_VECTOR_SIZE 512
+#include <vectorclass/vectorclass.h>
+
+namespace GAUSSIAN_DISPATCH_NAMESPACE {
+#include <cpixmap.hpp>
+#include <cpackedpixmap.hpp>
+#include <chalf.hpp>
+#include <cchunk.hpp>
+#include "gaussian_filter.SIMD.hpp"
+}
+
+#if INSTRSET != 2 && INSTRSET != 5 && INSTRSET != 8 && INSTRSET != 9
+# error "Compile with one of -msse2, -msse4.1, -mavx2 or -mavx512bw!"
+#endif
+#if INSTRSET >= 8 && (!defined(__F16C__) || !defined(__FMA__))
+# error "The AVX2 and AVX-512 variants need -mfma and -mf16c!"
+#endif
+
+// the classes of the application, only passed through by reference
+template <typename T> class cpixmap;
+template <typename T> class cpackedpixmap;
+struct half_t;
+
+namespace GAUSSIAN_DISPATCH_NAMESPACE {
+// The pixmaps of the application are handed to the copies of their classes in this
+// namespace, which come from the same headers and have the same layout.
+template <typename T> struct local_type { typedef T type; };
+template <> struct local_type< ::half_t> { typedef half_t type; };
+template <typename T> struct local_type< ::cpixmap<T> > { typedef cpixmap<typename local_type<T>::type> type; };
+template <typename T> struct local_type< ::cpackedpixmap<T> > { typedef cpackedpixmap<typename local_type<T>::type> type; };
+
+template <typename T>
+static inline typename local_type<T>::type& getLocal(T& pixmap)
+{
+  return reinterpret_cast<typename local_type<T>::type&>(pixmap);
+}
+
+template <typename P>
+static void dispatchGaussian3x3(P& dst, P& src)
+{
+  blurGaussian3x3Kernel(getLocal(dst), getLocal(src));
+}
+
+template <typename P>
+static void dispatchDirectional3x1(P& dst, P& src)
+{
+  blurDirectionalGaussian3x1Kernel(getLocal(dst), getLocal(src));
+}
+
+template <typename P, typename M>
+static void dispatchDirectional3x1(P& dst, M& dirmap, P& src)
+{
+  blurDirectionalGaussian3x1Kernel(getLocal(dst), getLocal(dirmap), getLocal(src));
+}
+
+template <typename P, typename M>
+static void dispatchDirectional5x1(P& dst, M& dirmap, P& src)
+{
+  blurDirectionalGaussian5x1Kernel(getLocal(dst), getLocal(dirmap), getLocal(src));
+}
+}
+
+// table of the kernels compiled for one instruction set
+typedef struct {
+  const char *name;
+  void (*blur8u)(cpixmap<uint8_t>&, cpixmap<uint8_t>&);
+  void (*blur8s)(cpixmap<int8_t>&, cpixmap<int8_t>&);
+  void (*blur16u)(cpixmap<uint16_t>&, cpixmap<uint16_t>&);
+  void (*blur16s)(cpixmap<int16_t>&, cpixmap<int16_t>&);
+  void (*blur32u)(cpixmap<uint32_t>&, cpixmap<uint32_t>&);
+  void (*blur32s)(cpixmap<int32_t>&, cpixmap<int32_t>&);
+  void (*blur32f)(cpixmap<float>&, cpixmap<float>&);
+  void (*blur64f)(cpixmap<double>&, cpixmap<double>&);
+  void (*blur16f)(cpixmap<half_t>&, cpixmap<half_t>&);
+  void (*packed8u)(cpackedpixmap<uint8_t>&, cpackedpixmap<uint8_t>&);
+  void (*packed16u)(cpackedpixmap<uint16_t>&, cpackedpixmap<uint16_t>&);
+  void (*packed32f)(cpackedpixmap<float>&, cpackedpixmap<float>&);
+  void (*packed64f)(cpackedpixmap<double>&, cpackedpixmap<double>&);
+  void (*directional8u)(cpixmap<uint8_t>&, cpixmap<uint8_t>&, cpixmap<uint8_t>&);
+  void (*directional16u)(cpixmap<uint16_t>&, cpixmap<uint8_t>&, cpixmap<uint16_t>&);
+  void (*fused8u)(cpixmap<uint8_t>&, cpixmap<uint8_t>&);
+  void (*fused16u)(cpixmap<uint16_t>&, cpixmap<uint16_t>&);
+  void (*directional5x1_8u)(cpixmap<uint8_t>&, cpixmap<uint8_t>&, cpixmap<uint8_t>&);
+  void (*directional5x1_16u)(cpixmap<uint16_t>&, cpixmap<uint8_t>&, cpixmap<uint16_t>&);
+  void (*recursive)(float *, const float *, const float *, const float *, const float *, size_t,
+		    float, float, float, float);
+} gaussian_dispatch_t;
+
+extern const gaussian_dispatch_t gaussian_dispatch_SSE2;
+extern const gaussian_dispatch_t gaussian_dispatch_SSE41;
+extern const gaussian_dispatch_t gaussian_dispatch_AVX2;
+extern const gaussian_dispatch_t gaussian_dispatch_AVX512BW;
+
+#if INSTRSET == 2 // SSE2
+# define GAUSSIAN_DISPATCH_TABLE gaussian_dispatch_SSE2
+# define GAUSSIAN_DISPATCH_NAME "SSE2"
+#elif INSTRSET == 5 // SSE4.1
+# define GAUSSIAN_DISPATCH_TABLE gaussian_dispatch_SSE41
+# define GAUSSIAN_DISPATCH_NAME "SSE4.1"
+#elif INSTRSET == 8 // AVX2
+# define GAUSSIAN_DISPATCH_TABLE gaussian_dispatch_AVX2
+# define GAUSSIAN_DISPATCH_NAME "AVX2"
+#elif INSTRSET == 9 // AVX512BW
+# define GAUSSIAN_DISPATCH_TABLE gaussian_dispatch_AVX512BW
+# define GAUSSIAN_DISPATCH_NAME "AVX512BW"
+#endif
+
+const gaussian_dispatch_t GAUSSIAN_DISPATCH_TABLE = {
+  GAUSSIAN_DISPATCH_NAME,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchGaussian3x3,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchGaussian3x3,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchGaussian3x3,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchGaussian3x3,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchGaussian3x3,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchGaussian3x3,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchGaussian3x3,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchGaussian3x3,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchGaussian3x3,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchGaussian3x3,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchGaussian3x3,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchGaussian3x3,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchGaussian3x3,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchDirectional3x1,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchDirectional3x1,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchDirectional3x1,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchDirectional3x1,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchDirectional5x1,
+  &GAUSSIAN_DISPATCH_NAMESPACE::dispatchDirectional5x1,
+  &GAUSSIAN_DISPATCH_NAMESPACE::filterRecursiveStep
+};
+
+#if INSTRSET == 2
+// the dispatcher lives only in the lowest of the compiled versions
+# include "vectorclass/instrset_detect.cpp"
+
+// the AVX2 and AVX-512 variants are built with FMA and convert half pixels with F16C, without
+// both the SSE4.1 one takes over
+static bool hasGaussianDispatch(int required)
+{
+  return VCL_NAMESPACE::instrset_detect() >= required &&
+    (required < 8 || (VCL_NAMESPACE::hasFMA3() && VCL_NAMESPACE::hasF16C()));
+}
+
+static const gaussian_dispatch_t *selectGaussianDispatch(void)
+{
+  if (hasGaussianDispatch(11)) return &gaussian_dispatch_AVX512BW; // AVX512BW + AVX512DQ
+  if (hasGaussianDispatch(8)) return &gaussian_dispatch_AVX2;
+  if (hasGaussianDispatch(5)) return &gaussian_dispatch_SSE41;
+  if (hasGaussianDispatch(2)) return &gaussian_dispatch_SSE2;
+
+  std::fprintf(stderr, "Error: instruction set SSE2 is not supported on this computer\n");
+  std::abort();
+  return NULL;
+}
+
+static const gaussian_dispatch_t *forcedGaussianDispatch = NULL; // set by setGaussianDispatch
+
+// selected once on the first call
+static const gaussian_dispatch_t *getGaussianDispatch(void)
+{
+  if (forcedGaussianDispatch) return forcedGaussianDispatch;
+  static const gaussian_dispatch_t *dispatch = selectGaussianDispatch();
+  return dispatch;
+}
+
+bool setGaussianDispatch(const char *name)
+{
+  if (!name) {
+    forcedGaussianDispatch = NULL;
+    return true;
+  }
+  static const gaussian_dispatch_t *const tables[] = {
+    &gaussian_dispatch_AVX512BW, &gaussian_dispatch_AVX2, &gaussian_dispatch_SSE41, &gaussian_dispatch_SSE2
+  };
+  static const int required[] = { 11, 8, 5, 2 };
+  for (int i = 0; i < 4; ++i) {
+    if (strcmp(name, tables[i]->name)) continue;
+    if (!hasGaussianDispatch(required[i])) return false;
+    forcedGaussianDispatch = tables[i];
+    return true;
+  }
+  return false;
+}
+
+void blurGaussian3x3Kernel(cpixmap<uint8_t>& dst, cpixmap<uint8_t>& src)
+{
+  getGaussianDispatch()->blur8u(dst, src);
+}
+
+void blurGaussian3x3Kernel(cpixmap<int8_t>& dst, cpixmap<int8_t>& src)
+{
+  getGaussianDispatch()->blur8s(dst, src);
+}
+
+void blurGaussian3x3Kernel(cpixmap<uint16_t>& dst, cpixmap<uint16_t>& src)
+{
+  getGaussianDispatch()->blur16u(dst, src);
+}
+
+void blurGaussian3x3Kernel(cpixmap<int16_t>& dst, cpixmap<int16_t>& src)
+{
+  getGaussianDispatch()->blur16s(dst, src);
+}
+
+void blurGaussian3x3Kernel(cpixmap<uint32_t>& dst, cpixmap<uint32_t>& src)
+{
+  getGaussianDispatch()->blur32u(dst, src);
+}
+
+void blurGaussian3x3Kernel(cpixmap<int32_t>& dst, cpixmap<int32_t>& src)
+{
+  getGaussianDispatch()->blur32s(dst, src);
+}
+
+void blurGaussian3x3Kernel(cpixmap<float>& dst, cpixmap<float>& src)
+{
+  getGaussianDispatch()->blur32f(dst, src);
+}
+
+void blurGaussian3x3Kernel(cpixmap<double>& dst, cpixmap<double>& src)
+{
+  getGaussianDispatch()->blur64f(dst, src);
+}
+
+void blurGaussian3x3Kernel(cpixmap<half_t>& dst, cpixmap<half_t>& src)
+{
+  getGaussianDispatch()->blur16f(dst, src);
+}
+
+void blurGaussian3x3Kernel(cpackedpixmap<uint8_t>& dst, cpackedpixmap<uint8_t>& src)
+{
+  getGaussianDispatch()->packed8u(dst, src);
+}
+
+void blurGaussian3x3Kernel(cpackedpixmap<uint16_t>& dst, cpackedpixmap<uint16_t>& src)
+{
+  getGaussianDispatch()->packed16u(dst, src);
+}
+
+void blurGaussian3x3Kernel(cpackedpixmap<float>& dst, cpackedpixmap<float>& src)
+{
+  getGaussianDispatch()->packed32f(dst, src);
+}
+
+void blurGaussian3x3Kernel(cpackedpixmap<double>& dst, cpackedpixmap<double>& src)
+{
+  getGaussianDispatch()->packed64f(dst, src);
+}
+
+void blurDirectionalGaussian3x1Kernel(cpixmap<uint8_t>& dst, cpixmap<uint8_t>& dirmap, cpixmap<uint8_t>& src)
+{
+  getGaussianDispatch()->directional8u(dst, dirmap, src);
+}
+
+void blurDirectionalGaussian3x1Kernel(cpixmap<uint16_t>& dst, cpixmap<uint8_t>& dirmap, cpixmap<uint16_t>& src)
+{
+  getGaussianDispatch()->directional16u(dst, dirmap, src);
+}
+
+void blurDirectionalGaussian3x1Kernel(cpixmap<uint8_t>& dst, cpixmap<uint8_t>& src)
+{
+  getGaussianDispatch()->fused8u(dst, src);
+}
+
+void blurDirectionalGaussian3x1Kernel(cpixmap<uint16_t>& dst, cpixmap<uint16_t>& src)
+{
+  getGaussianDispatch()->fused16u(dst, src);
+}
+
+void blurDirectionalGaussian5x1Kernel(cpixmap<uint8_t>& dst, cpixmap<uint8_t>& dirmap, cpixmap<uint8_t>& src)
+{
+  getGaussianDispatch()->directional5x1_8u(dst, dirmap, src);
+}
+
+void blurDirectionalGaussian5x1Kernel(cpixmap<uint16_t>& dst, cpixmap<uint8_t>& dirmap, cpixmap<uint16_t>& src)
+{
+  getGaussianDispatch()->directional5x1_16u(dst, dirmap, src);
+}
+
+void filterRecursiveStep(float *out, const float *in,
+			 const float *p1, const float *p2, const float *p3, size_t len,
+			 float B, float b1, float b2, float b3)
+{
+  getGaussianDispatch()->recursive(out, in, p1, p2, p3, len, B, b1, b2, b3);
+}
+
+const char *getGaussianDispatchName(void)
+{
+  return getGaussianDispatch()->name;
+}
+
+#endif // INSTRSET == 2
@@ -0,0 +1,57 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <cpixmap.hpp>
+#include <cpackedpixmap.hpp>
+#include <chalf.hpp>
+
+// SIMD kernels selected at run time, see gaussian_filter.dispatch.cpp for building them.
+
+void blurGaussian3x3Kernel(cpixmap<uint8_t>& dst, cpixmap<uint8_t>& src);
+void blurGaussian3x3Kernel(cpixmap<int8_t>& dst, cpixmap<int8_t>& src);
+void blurGaussian3x3Kernel(cpixmap<uint16_t>& dst, cpixmap<uint16_t>& src);
+void blurGaussian3x3Kernel(cpixmap<int16_t>& dst, cpixmap<int16_t>& src);
+void blurGaussian3x3Kernel(cpixmap<uint32_t>& dst, cpixmap<uint32_t>& src);
+void blurGaussian3x3Kernel(cpixmap<int32_t>& dst, cpixmap<int32_t>& src);
+void blurGaussian3x3Kernel(cpixmap<float>& dst, cpixmap<float>& src);
+void blurGaussian3x3Kernel(cpixmap<double>& dst, cpixmap<double>& src);
+void blurGaussian3x3Kernel(cpixmap<half_t>& dst, cpixmap<half_t>& src);
+void blurGaussian3x3Kernel(cpackedpixmap<uint8_t>& dst, cpackedpixmap<uint8_t>& src);
+void blurGaussian3x3Kernel(cpackedpixmap<uint16_t>& dst, cpackedpixmap<uint16_t>& src);
+void blurGaussian3x3Kernel(cpackedpixmap<float>& dst, cpackedpixmap<float>& src);
+void blurGaussian3x3Kernel(cpackedpixmap<double>& dst, cpackedpixmap<double>& src);
+
+void blurDirectionalGaussian3x1Kernel(cpixmap<uint8_t>& dst, cpixmap<uint8_t>& dirmap, cpixmap<uint8_t>& src);
+void blurDirectionalGaussian3x1Kernel(cpixmap<uint16_t>& dst, cpixmap<uint8_t>& dirmap, cpixmap<uint16_t>& src);
+void blurDirectionalGaussian3x1Kernel(cpixmap<uint8_t>& dst, cpixmap<uint8_t>& src);
+void blurDirectionalGaussian3x1Kernel(cpixmap<uint16_t>& dst, cpixmap<uint16_t>& src);
+void blurDirectionalGaussian5x1Kernel(cpixmap<uint8_t>& dst, cpixmap<uint8_t>& dirmap, cpixmap<uint8_t>& src);
+void blurDirectionalGaussian5x1Kernel(cpixmap<uint16_t>& dst, cpixmap<uint8_t>& dirmap, cpixmap<uint16_t>& src);
+
+void filterRecursiveStep(float *out, const float *in,
+			 const float *p1, const float *p2, const float *p3, size_t len,
+			 float B, float b1, float b2, float b3);
+
+// name of the variant in use: "SSE2", "SSE4.1", "AVX2" or "AVX512BW"
+const char *getGaussianDispatchName(void);
+// forces the variant of that name, false if there is none or the CPU lacks it; NULL goes back
+// to the best one. Meant for benchmarks and tests, not to be called while kernels run.
+bool setGaussianDispatch(const char *name);
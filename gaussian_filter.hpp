@@ -21,64 +21,119 @@
 #include <limits>
 #include <iostream>
 #include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
 #include <float.h>
 
 #include <cpixmap.hpp>
+#include <cpackedpixmap.hpp>
+#include <chalf.hpp>
 #include <cchunk.hpp>
+#include "gaussian_filter.direction.hpp"
 
-#if !defined(USE_SIMD)
-
+// 1-2-1 weights of a 3x3 neighbourhood: integers in exact sums rounded once
 template <typename T>
-void blurGaussian3x3Kernel(cpixmap<T>& dst, cpixmap<T>& src)
+inline T getGaussian3x3(T nw, T nn, T ne, T ww, T oo, T ee, T sw, T ss, T se)
 {
   assert(std::numeric_limits<T>::is_integer);
-  //assert(!std::numeric_limits<T>::is_signed);
-  assert(std::numeric_limits<T>::digits < std::numeric_limits<int>::digits);
+  assert(std::numeric_limits<T>::digits < std::numeric_limits<int64_t>::digits - 4);
+  int64_t sum =
+    (int64_t)nw*1 + (int64_t)nn*2 + (int64_t)ne*1 +
+    (int64_t)ww*2 + (int64_t)oo*4 + (int64_t)ee*2 +
+    (int64_t)sw*1 + (int64_t)ss*2 + (int64_t)se*1;
+  return static_cast<T>((sum + 8) >> 4);
+}
+
+// floating point in the order of the SIMD kernels, vertical (n + s) + 2*o sums first and then
+// the same across them times 1/16; the weights are powers of two, so the products are exact
+// and a fused multiply-add gives the same bits as a multiply and an add
+template <typename T>
+inline T sumGaussian121(T a, T o, T b) { return (a + b) + T(2)*o; }
+
+inline float getGaussian3x3(float nw, float nn, float ne, float ww, float oo, float ee, float sw, float ss, float se)
+{
+  return sumGaussian121(sumGaussian121(nw, ww, sw), sumGaussian121(nn, oo, ss), sumGaussian121(ne, ee, se)) * 0.0625f;
+}
+
+inline double getGaussian3x3(double nw, double nn, double ne, double ww, double oo, double ee, double sw, double ss, double se)
+{
+  return sumGaussian121(sumGaussian121(nw, ww, sw), sumGaussian121(nn, oo, ss), sumGaussian121(ne, ee, se)) * 0.0625;
+}
+
+// half pixels in float, rounded once on the way back
+inline half_t getGaussian3x3(half_t nw, half_t nn, half_t ne, half_t ww, half_t oo, half_t ee, half_t sw, half_t ss, half_t se)
+{
+  return half_t(getGaussian3x3((float)nw, (float)nn, (float)ne, (float)ww, (float)oo, (float)ee, (float)sw, (float)ss, (float)se));
+}
+
+// exact 1-2-1 weights, the reference of the SIMD kernels
+template <typename T>
+void blurGaussian3x3KernelReference(cpixmap<T>& dst, cpixmap<T>& src)
+{
   //assert(dst.isMatched((dimension)src));
   
   assert(dst.getWidth() == src.getWidth());
   assert(dst.getHeight() == src.getHeight());
   assert(dst.getBands() >= src.getBands());
 
+  const size_t strips = getStripCount(src.getHeight());
+
   for (size_t z = 0; z < src.getBands(); ++z) {
-    window3x3_frame<T> win3x3(src);
-    win3x3.draftFrame(src, z);
-    
-    for (size_t y = 0; y < src.getHeight(); ++y) {
-      T *dst_line = dst.getLine(y, z);
 #pragma omp parallel for
-      for (size_t x = 0; x < src.getWidth(); ++x) {
-	dst_line[x] = static_cast<T>(
-	  ((float)win3x3(y-1, x-1)*1)/16 + ((float)win3x3(y-1, x)*2)/16 + ((float)win3x3(y-1, x+1)*1)/16 +
-	  ((float)win3x3(y,   x-1)*2)/16 + ((float)win3x3(y,   x)*4)/16 + ((float)win3x3(y,   x+1)*2)/16 +
-	  ((float)win3x3(y+1, x-1)*1)/16 + ((float)win3x3(y+1, x)*2)/16 + ((float)win3x3(y+1, x+1)*1)/16);
-	  
-	  /*
-	  (win3x3(y-1, x-1)>>4) + (win3x3(y-1, x)>>3) + (win3x3(y-1, x+1)>>4) +
-	  (win3x3(y,   x-1)>>3) + (win3x3(y,   x)>>2) + (win3x3(y,   x+1)>>3) +
-	  (win3x3(y+1, x-1)>>4) + (win3x3(y+1, x)>>3) + (win3x3(y+1, x+1)>>4);
-	  */
+    for (size_t s = 0; s < strips; ++s) {
+      const size_t yBegin = src.getHeight() * s / strips;
+      const size_t yEnd = src.getHeight() * (s+1) / strips;
+      window3x3_frame<T> win3x3(src);
+      win3x3.draftFrame(src, z, yBegin);
+    
+      for (size_t y = yBegin; y < yEnd; ++y) {
+	T *dst_line = dst.getLine(y, z);
+	const T *prev = win3x3.getPrevLine();
+	const T *curr = win3x3.getCurrLine();
+	const T *next = win3x3.getNextLine();
+	for (size_t x = 0; x < src.getWidth(); ++x) {
+	  const int i = (int)x;
+	  dst_line[x] = getGaussian3x3(prev[i-1], prev[i], prev[i+1], curr[i-1], curr[i], curr[i+1], next[i-1], next[i], next[i+1]);
+	}
+	win3x3.shiftFrame(src, z);
       }
-      win3x3.shiftFrame(src, z);
     }
   }
 }
 
-#else
-# include "gaussian_filter.SIMD.hpp"
-#endif
+// the same on packed pixels: the neighbours of a sample are the samples of the same channel
+// one pixel away, channels apart in the line; rows are read in place, dst must not be src
+template <typename T>
+void blurGaussian3x3KernelReference(cpackedpixmap<T>& dst, cpackedpixmap<T>& src)
+{
+  assert(dst.isMatched(src));
 
-typedef enum {
-  UNDIRECTIONAL = 0,
-  HORIZONTAL = 1,
-  VERTICAL = 2, 
-  DIAGONAL1 = 3,
-  DIAGONAL2 = 4,
-  NR_DIRECTION = 5
-} direction_t;
+  const int width = (int)src.getWidth(), height = (int)src.getHeight(), channels = (int)src.getChannels();
+  const size_t strips = getStripCount(src.getHeight());
 
+#pragma omp parallel for
+  for (size_t s = 0; s < strips; ++s) {
+    const int yBegin = (int)(src.getHeight() * s / strips);
+    const int yEnd = (int)(src.getHeight() * (s+1) / strips);
+    for (int y = yBegin; y < yEnd; ++y) {
+      T *dst_line = dst.getLine(y);
+      const T *prev = src.getLine(std::max(y-1, 0));
+      const T *curr = src.getLine(y);
+      const T *next = src.getLine(std::min(y+1, height-1));
+      for (int x = 0; x < width; ++x) {
+	const int w = std::max(x-1, 0) * channels, o = x * channels, e = std::min(x+1, width-1) * channels;
+	for (int c = 0; c < channels; ++c)
+	  dst_line[o+c] = getGaussian3x3(prev[w+c], prev[o+c], prev[e+c], curr[w+c], curr[o+c], curr[e+c],
+					 next[w+c], next[o+c], next[e+c]);
+      }
+    }
+  }
+}
+
+// directions first, then a 1-2-1 blur along the direction most of the 3x3 neighbours agree on
 template <typename T>
-void blurDirectionalGaussian3x1Kernel(cpixmap<T>& dst, cpixmap<uint8_t>& dirmap, cpixmap<T>& src)
+void blurDirectionalGaussian3x1KernelReference(cpixmap<T>& dst, cpixmap<uint8_t>& dirmap, cpixmap<T>& src)
 {
   assert(std::numeric_limits<T>::is_integer);
   //assert(!std::numeric_limits<T>::is_signed);
@@ -86,104 +141,760 @@ void blurDirectionalGaussian3x1Kernel(cpixmap<T>& dst, cpixmap<uint8_t>& dirmap,
   assert(dst.isMatched(src));
   assert(dst.isMatched(dirmap));
 
+  const size_t strips = getStripCount(src.getHeight());
+
   for (size_t z = 0; z < src.getBands(); ++z) {
-    window3x3_frame<T> win3x3(src);
-    win3x3.draftFrame(src, z);
+#pragma omp parallel for
+    for (size_t s = 0; s < strips; ++s) {
+      const size_t yBegin = src.getHeight() * s / strips;
+      const size_t yEnd = src.getHeight() * (s+1) / strips;
+      window3x3_frame<T> win3x3(src);
+      win3x3.draftFrame(src, z, yBegin);
     
-    for (size_t y = 0; y < src.getHeight(); ++y) {
-      uint8_t *dirLine = dirmap.getLine(y, z);
+      for (size_t y = yBegin; y < yEnd; ++y) {
+	uint8_t *dirLine = dirmap.getLine(y, z);
+	const T *prev = win3x3.getPrevLine(), *curr = win3x3.getCurrLine(), *next = win3x3.getNextLine();
+	for (size_t x = 0; x < src.getWidth(); ++x)
+	  dirLine[x] = getDirection3x1(prev, curr, next, (int)x);
+	win3x3.shiftFrame(src, z);
+      }
+    }
+  }
+
+  for (size_t z = 0; z < src.getBands(); ++z) {
 #pragma omp parallel for
-      for (size_t x = 0; x < src.getWidth(); ++x) {
-	int hDiff = std::abs((int)win3x3(y, x-1) - (int)win3x3(y, x+1));
-	int hDir = hDiff + (hDiff>>2) + (hDiff>>3) + (hDiff>>5);
-	
-	int vDiff = std::abs((int)win3x3(y-1, x) - (int)win3x3(y+1, x));
-	int vDir = vDiff + (vDiff>>2) + (vDiff>>3) + (vDiff>>5);
-	
-	//int hDir = hDiff + (hDiff/4) + (hDiff/8) + (hDiff/32);
-	//int vDir = vDiff + (vDiff/4) + (vDiff/8) + (vDiff/32);
-	int d1Diff = std::abs((int)win3x3(y-1, x+1) - (int)win3x3(y+1, x-1));
-	int d2Diff = std::abs((int)win3x3(y-1, x-1) - (int)win3x3(y+1, x+1));
-
-	if (hDir > vDir) {
-	  if (hDir > d1Diff) {
-	    if (hDir > d2Diff) dirLine[x] = HORIZONTAL; // H
-	    else dirLine[x] = DIAGONAL2; // D2
-	  } else {
-	    if (d1Diff > d2Diff) dirLine[x] = DIAGONAL1; // D1
-	    else dirLine[x] = DIAGONAL2; // D2
-	  }
-	} else {
-	  if (vDir > d1Diff) {
-	    if (vDir > d2Diff) dirLine[x] = VERTICAL; // V
-	    else dirLine[x] = DIAGONAL2; // D2
-	  } else {
-	    if (d1Diff > d2Diff) dirLine[x] = DIAGONAL1; // D1
-	    else dirLine[x] = DIAGONAL2; // D2
-	  }
+    for (size_t s = 0; s < strips; ++s) {
+      const size_t yBegin = src.getHeight() * s / strips;
+      const size_t yEnd = src.getHeight() * (s+1) / strips;
+      window3x3_frame<uint8_t> dir3x3(dirmap);
+      dir3x3.draftFrame(dirmap, z, yBegin);
+
+      window3x3_frame<T> img3x3(src);
+      img3x3.draftFrame(src, z, yBegin);
+    
+      for (size_t y = yBegin; y < yEnd; ++y) {
+	T *dstLine = dst.getLine(y, z);
+	const uint8_t *dPrev = dir3x3.getPrevLine(), *dCurr = dir3x3.getCurrLine(), *dNext = dir3x3.getNextLine();
+	const T *prev = img3x3.getPrevLine(), *curr = img3x3.getCurrLine(), *next = img3x3.getNextLine();
+	for (size_t x = 0; x < src.getWidth(); ++x)
+	  dstLine[x] = blurDirection3x1(voteDirection3x1(dPrev, dCurr, dNext, (int)x), prev, curr, next, (int)x);
+
+	dir3x3.shiftFrame(dirmap, z);
+	img3x3.shiftFrame(src, z);
+      }
+    }
+  }
+}
+
+// the same filter in one sweep: only three lines of direction codes are kept,
+// the output follows one line behind the direction codes
+template <typename T>
+void blurDirectionalGaussian3x1KernelReference(cpixmap<T>& dst, cpixmap<T>& src)
+{
+  assert(std::numeric_limits<T>::is_integer);
+  assert(std::numeric_limits<T>::digits < std::numeric_limits<int>::digits);
+  assert(dst.isMatched(src));
+
+  const int width = (int)src.getWidth();
+  const int height = (int)src.getHeight();
+  const size_t strips = getStripCount(src.getHeight());
+
+  for (size_t z = 0; z < src.getBands(); ++z) {
+#pragma omp parallel for
+    for (size_t s = 0; s < strips; ++s) {
+      const int yBegin = (int)(src.getHeight() * s / strips);
+      const int yEnd = (int)(src.getHeight() * (s+1) / strips);
+      cdirectionring ring(width);
+      int dirRow = std::max(yBegin-1, 0);
+      window3x3_frame<T> win3x3(src);
+      win3x3.draftFrame(src, z, dirRow);
+      window3x3_frame<T> img3x3(src);
+      img3x3.draftFrame(src, z, yBegin);
+
+      for (int y = yBegin; y < yEnd; ++y) {
+	for (; dirRow <= std::min(y+1, height-1); ++dirRow) {
+	  uint8_t *dirLine = ring.getLine(dirRow);
+	  const T *prev = win3x3.getPrevLine(), *curr = win3x3.getCurrLine(), *next = win3x3.getNextLine();
+	  for (int x = 0; x < width; ++x)
+	    dirLine[x] = getDirection3x1(prev, curr, next, x);
+	  ring.fillLine(dirRow);
+	  win3x3.shiftFrame(src, z);
 	}
+
+	T *dstLine = dst.getLine(y, z);
+	const uint8_t *dPrev = ring.getLine(y-1, height), *dCurr = ring.getLine(y), *dNext = ring.getLine(y+1, height);
+	const T *prev = img3x3.getPrevLine(), *curr = img3x3.getCurrLine(), *next = img3x3.getNextLine();
+	for (int x = 0; x < width; ++x)
+	  dstLine[x] = blurDirection3x1(voteDirection3x1(dPrev, dCurr, dNext, x), prev, curr, next, x);
+	img3x3.shiftFrame(src, z);
       }
-      win3x3.shiftFrame(src, z);
     }
   }
+}
+
+// orientations from the 5x5 neighbourhood first, then a 1-4-6-4-1 blur along the orientation
+// most of the 3x3 neighbours agree on
+template <typename T>
+void blurDirectionalGaussian5x1KernelReference(cpixmap<T>& dst, cpixmap<uint8_t>& dirmap, cpixmap<T>& src)
+{
+  assert(std::numeric_limits<T>::is_integer);
+  assert(std::numeric_limits<T>::digits < std::numeric_limits<int>::digits);
+  assert(dst.isMatched(src));
+  assert(dst.isMatched(dirmap));
+
+  const size_t strips = getStripCount(src.getHeight());
 
   for (size_t z = 0; z < src.getBands(); ++z) {
-    window3x3_frame<uint8_t> dir3x3(dirmap);
-    dir3x3.draftFrame(dirmap, z);
+#pragma omp parallel for
+    for (size_t s = 0; s < strips; ++s) {
+      const size_t yBegin = src.getHeight() * s / strips;
+      const size_t yEnd = src.getHeight() * (s+1) / strips;
+      window5x5_frame<T> win5x5(src);
+      win5x5.draftFrame(src, z, yBegin);
 
-    window3x3_frame<T> img3x3(src);
-    img3x3.draftFrame(src, z);
-    
-    for (size_t y = 0; y < src.getHeight(); ++y) {
-      T *dstLine = dst.getLine(y, z);
+      for (size_t y = yBegin; y < yEnd; ++y) {
+	uint8_t *dirLine = dirmap.getLine(y, z);
+	const T *lines[5] = { win5x5.getLine(-2), win5x5.getLine(-1), win5x5.getLine(0), win5x5.getLine(1), win5x5.getLine(2) };
+	for (size_t x = 0; x < src.getWidth(); ++x)
+	  dirLine[x] = getDirection5x1(lines, (int)x);
+	win5x5.shiftFrame(src, z);
+      }
+    }
+  }
+
+  for (size_t z = 0; z < src.getBands(); ++z) {
 #pragma omp parallel for
-      for (size_t x = 0; x < src.getWidth(); ++x) {
-	int dirCount[NR_DIRECTION] = {0,0,0,0,0};
-	//std::memset(dirCount, 0, NR_DIRECTION * sizeof(int));
-	dirCount[dir3x3(y-1, x-1)]++, dirCount[dir3x3(y-1, x)]++, dirCount[dir3x3(y-1, x+1)]++;
-	dirCount[dir3x3(y, x-1)]++, dirCount[dir3x3(y, x)]++, dirCount[dir3x3(y, x+1)]++;
-	dirCount[dir3x3(y+1, x-1)]++, dirCount[dir3x3(y+1, x)]++, dirCount[dir3x3(y+1, x+1)]++;
-
-	/*
-	int maxarg = 1;
-	for (int i = HORIZONTAL+1; i < NR_DIRECTION; i++) {
-	  if (dirCount[i] > dirCount[maxarg]) maxarg = i;
+    for (size_t s = 0; s < strips; ++s) {
+      const size_t yBegin = src.getHeight() * s / strips;
+      const size_t yEnd = src.getHeight() * (s+1) / strips;
+      window3x3_frame<uint8_t> dir3x3(dirmap);
+      dir3x3.draftFrame(dirmap, z, yBegin);
+      window5x5_frame<T> img5x5(src);
+      img5x5.draftFrame(src, z, yBegin);
+
+      for (size_t y = yBegin; y < yEnd; ++y) {
+	T *dstLine = dst.getLine(y, z);
+	const uint8_t *dPrev = dir3x3.getPrevLine(), *dCurr = dir3x3.getCurrLine(), *dNext = dir3x3.getNextLine();
+	const T *lines[5] = { img5x5.getLine(-2), img5x5.getLine(-1), img5x5.getLine(0), img5x5.getLine(1), img5x5.getLine(2) };
+	for (size_t x = 0; x < src.getWidth(); ++x)
+	  dstLine[x] = blurDirection5x1(voteDirection5x1(dPrev, dCurr, dNext, (int)x), lines, (int)x);
+
+	dir3x3.shiftFrame(dirmap, z);
+	img5x5.shiftFrame(src, z);
+      }
+    }
+  }
+}
+
+#if defined(USE_SIMD_DISPATCH)
+# include "gaussian_filter.dispatch.hpp"
+#elif !defined(USE_SIMD)
+
+template <typename T>
+void blurGaussian3x3Kernel(cpixmap<T>& dst, cpixmap<T>& src)
+{
+  blurGaussian3x3KernelReference(dst, src);
+}
+
+// one step of a vertical recursion over a whole line: out = B*in + b1*p1 + b2*p2 + b3*p3
+inline void filterRecursiveStep(float *out, const float *in,
+				const float *p1, const float *p2, const float *p3, size_t len,
+				float B, float b1, float b2, float b3)
+{
+  for (size_t x = 0; x < len; ++x)
+    out[x] = B*in[x] + b1*p1[x] + b2*p2[x] + b3*p3[x];
+}
+
+#else
+# include "gaussian_filter.SIMD.hpp"
+#endif
+
+// the SIMD headers add exact overloads for the pixel types they vectorize
+template <typename T>
+void blurGaussian3x3Kernel(cpackedpixmap<T>& dst, cpackedpixmap<T>& src)
+{
+  blurGaussian3x3KernelReference(dst, src);
+}
+
+template <typename T>
+void blurDirectionalGaussian3x1Kernel(cpixmap<T>& dst, cpixmap<uint8_t>& dirmap, cpixmap<T>& src)
+{
+  blurDirectionalGaussian3x1KernelReference(dst, dirmap, src);
+}
+
+// 8 orientations and 5 taps, takes the same arguments as the 3x1 filter
+template <typename T>
+void blurDirectionalGaussian5x1Kernel(cpixmap<T>& dst, cpixmap<uint8_t>& dirmap, cpixmap<T>& src)
+{
+  blurDirectionalGaussian5x1KernelReference(dst, dirmap, src);
+}
+
+// without a dirmap the filter runs fused in one sweep
+template <typename T>
+void blurDirectionalGaussian3x1Kernel(cpixmap<T>& dst, cpixmap<T>& src)
+{
+  blurDirectionalGaussian3x1KernelReference(dst, src);
+}
+
+// rounds and clamps a filtered value into the range of the pixel type
+template <typename T>
+inline T saturatePixel(double val)
+{
+  if (!std::numeric_limits<T>::is_integer) return static_cast<T>(val);
+  val = std::floor(val + 0.5);
+  if (val < (double)std::numeric_limits<T>::min()) return std::numeric_limits<T>::min();
+  if (val > (double)std::numeric_limits<T>::max()) return std::numeric_limits<T>::max();
+  return static_cast<T>(val);
+}
+
+// radius covering +/-3 sigma of the gaussian
+inline size_t getGaussianRadius(double sigma)
+{
+  if (sigma <= 0.0) return 0;
+  return static_cast<size_t>(std::ceil(3.0 * sigma));
+}
+
+// normalized 1-D gaussian of (radius<<1)+1 taps, kernel[radius] is the center
+inline void buildGaussianKernel(std::vector<float>& kernel, double sigma)
+{
+  size_t radius = getGaussianRadius(sigma);
+  kernel.assign((radius<<1) + 1, 0.0f);
+  if (radius == 0) {
+    kernel[0] = 1.0f;
+    return;
+  }
+
+  double sum = 0.0;
+  std::vector<double> weight((radius<<1) + 1);
+  for (size_t i = 0; i < weight.size(); ++i) {
+    double d = (double)i - (double)radius;
+    weight[i] = std::exp(-(d*d) / (2.0*sigma*sigma));
+    sum += weight[i];
+  }
+  for (size_t i = 0; i < weight.size(); ++i)
+    kernel[i] = static_cast<float>(weight[i] / sum);
+}
+
+// separable gaussian of arbitrary sigma: horizontal pass into a float plane, then vertical pass
+template <typename T>
+void blurGaussian(cpixmap<T>& dst, cpixmap<T>& src, double sigmaX, double sigmaY)
+{
+  assert(dst.getWidth() == src.getWidth());
+  assert(dst.getHeight() == src.getHeight());
+  assert(dst.getBands() >= src.getBands());
+
+  std::vector<float> hKernel, vKernel;
+  buildGaussianKernel(hKernel, sigmaX);
+  buildGaussianKernel(vKernel, sigmaY);
+  const int hRadius = (int)(hKernel.size()>>1);
+  const int vRadius = (int)(vKernel.size()>>1);
+
+  // every pixel of the intermediate plane is written before it is read; it lives as long as the call
+  // and stays out of the default pool, which would keep one for every size ever blurred
+  cpixmap<float> temp;
+  temp.setResolution(src.getWidth(), src.getHeight(), 1, false);
+  const size_t strips = getStripCount(src.getHeight());
+
+  for (size_t z = 0; z < src.getBands(); ++z) {
+#pragma omp parallel for
+    for (size_t s = 0; s < strips; ++s) {
+      const size_t yBegin = src.getHeight() * s / strips;
+      const size_t yEnd = src.getHeight() * (s+1) / strips;
+      cslice<T> hslice(src, 1, hRadius, 0);
+      hslice.draftSlice(src, z, yBegin);
+
+      for (size_t y = yBegin; y < yEnd; ++y) {
+	float *tempLine = temp.getLine(y);
+	const T *line = hslice.getLine(y);
+	for (size_t x = 0; x < src.getWidth(); ++x) {
+	  float sum = 0.0f;
+	  for (int k = -hRadius; k <= hRadius; ++k)
+	    sum += (float)line[(int)x+k] * hKernel[k+hRadius];
+	  tempLine[x] = sum;
 	}
-	*/
-	uint8_t maxarg;
-	if (dirCount[HORIZONTAL] > dirCount[VERTICAL]) {
-	  if (dirCount[HORIZONTAL] > dirCount[DIAGONAL1]) {
-	    if (dirCount[HORIZONTAL] > dirCount[DIAGONAL2]) maxarg = HORIZONTAL;
-	    else maxarg = DIAGONAL2;
-	  } else {
-	    if (dirCount[DIAGONAL1] > dirCount[DIAGONAL2]) maxarg = DIAGONAL1;
-	    else maxarg = DIAGONAL2;
+	hslice.shiftSlice(1, src, z);
+      }
+    }
+
+#pragma omp parallel for
+    for (size_t s = 0; s < strips; ++s) {
+      const size_t yBegin = src.getHeight() * s / strips;
+      const size_t yEnd = src.getHeight() * (s+1) / strips;
+      cslice<float> vslice(temp, 1, 0, vRadius);
+      vslice.draftSlice(temp, 0, yBegin);
+
+      std::vector<const float *> lines((vRadius<<1) + 1);
+      for (size_t y = yBegin; y < yEnd; ++y) {
+	T *dstLine = dst.getLine(y, z);
+	for (int k = -vRadius; k <= vRadius; ++k) lines[k+vRadius] = vslice.getLine((int)y+k);
+	for (size_t x = 0; x < src.getWidth(); ++x) {
+	  float sum = 0.0f;
+	  for (int k = 0; k <= (vRadius<<1); ++k)
+	    sum += lines[k][x] * vKernel[k];
+	  dstLine[x] = saturatePixel<T>(sum);
+	}
+	vslice.shiftSlice(1, temp);
+      }
+    }
+  }
+}
+
+typedef struct {
+  size_t width, height; // 0 picks the size from the L2 cache
+} tile_size_t;
+
+// Largest tile whose source lines with halo plus float rows fill about half of L2,
+// wide enough to keep the horizontal halo small and tall enough for the vertical one.
+template <typename T>
+tile_size_t getSeparableTileSize(size_t width, size_t height, int hRadius, int vRadius)
+{
+  const size_t budget = getL2CacheSize() >> 1;
+  tile_size_t tile;
+  tile.width = std::min(width, (size_t)std::max(256, hRadius<<3));
+  tile.height = 0;
+  for (;;) {
+    const size_t lineBytes = (tile.width + (hRadius<<1)) * sizeof(T) + tile.width * sizeof(float);
+    const size_t lines = budget / lineBytes;
+    if (lines > (size_t)(vRadius<<1)) tile.height = lines - (vRadius<<1);
+    if (tile.height >= (size_t)std::max(16, vRadius<<1) || tile.width <= 32) break;
+    tile.width >>= 1;
+  }
+  tile.height = std::max((size_t)1, std::min(tile.height, height));
+  return tile;
+}
+
+// blurGaussian tile by tile: both passes run on a cchunk tile with halo while it is still in cache,
+// so the image goes through memory once. The result is the same as blurGaussian.
+template <typename T>
+void blurGaussianTiled(cpixmap<T>& dst, cpixmap<T>& src, double sigmaX, double sigmaY, tile_size_t tile = tile_size_t())
+{
+  assert(dst.getWidth() == src.getWidth());
+  assert(dst.getHeight() == src.getHeight());
+  assert(dst.getBands() >= src.getBands());
+
+  std::vector<float> hKernel, vKernel;
+  buildGaussianKernel(hKernel, sigmaX);
+  buildGaussianKernel(vKernel, sigmaY);
+  const int hRadius = (int)(hKernel.size()>>1);
+  const int vRadius = (int)(vKernel.size()>>1);
+
+  const size_t width = src.getWidth(), height = src.getHeight();
+  if (width == 0 || height == 0) return;
+  if (tile.width == 0 || tile.height == 0) {
+    tile_size_t automatic = getSeparableTileSize<T>(width, height, hRadius, vRadius);
+    if (tile.width == 0) tile.width = automatic.width;
+    if (tile.height == 0) tile.height = automatic.height;
+  }
+  tile.width = std::min(tile.width, width), tile.height = std::min(tile.height, height);
+  const size_t tilesX = (width + tile.width - 1) / tile.width;
+  const size_t tilesY = (height + tile.height - 1) / tile.height;
+  const size_t rowCount = tile.height + (vRadius<<1);
+
+  for (size_t z = 0; z < src.getBands(); ++z) {
+#pragma omp parallel
+    {
+      cchunk<T> chunk(tile.width, tile.height, hRadius, vRadius);
+      std::vector<float> rows(rowCount * tile.width);
+      std::vector<const float *> lines((vRadius<<1) + 1);
+
+#pragma omp for schedule(dynamic)
+      for (size_t t = 0; t < tilesX * tilesY; ++t) {
+	const size_t x0 = (t % tilesX) * tile.width, y0 = (t / tilesX) * tile.height;
+	const size_t w = std::min(tile.width, width - x0), h = std::min(tile.height, height - y0);
+	chunk.draft(src, x0, y0, z);
+
+	// horizontal pass over the tile and its vertical halo
+	for (size_t i = 0; i < h + (vRadius<<1); ++i) {
+	  const T *line = chunk.getBufferLine(i);
+	  float *row = &rows[i * tile.width];
+	  for (size_t x = 0; x < w; ++x) {
+	    float sum = 0.0f;
+	    for (int k = -hRadius; k <= hRadius; ++k)
+	      sum += (float)line[(int)x+k] * hKernel[k+hRadius];
+	    row[x] = sum;
 	  }
-	} else {
-	  if (dirCount[VERTICAL] > dirCount[DIAGONAL1]) {
-	    if (dirCount[VERTICAL] > dirCount[DIAGONAL2]) maxarg = VERTICAL;
-	    else maxarg = DIAGONAL2;
-	  } else {
-	    if (dirCount[DIAGONAL1] > dirCount[DIAGONAL2]) maxarg = DIAGONAL1;
-	    else maxarg = DIAGONAL2;
+	}
+
+	// vertical pass on the rows just written
+	for (size_t j = 0; j < h; ++j) {
+	  T *dstLine = dst.getLine(y0 + j, z) + x0;
+	  for (int k = 0; k <= (vRadius<<1); ++k) lines[k] = &rows[(j+k) * tile.width];
+	  for (size_t x = 0; x < w; ++x) {
+	    float sum = 0.0f;
+	    for (int k = 0; k <= (vRadius<<1); ++k)
+	      sum += lines[k][x] * vKernel[k];
+	    dstLine[x] = saturatePixel<T>(sum);
 	  }
 	}
-	//maxarg = maxarg;
-	switch (maxarg) {
-	case HORIZONTAL:
-	  dstLine[x] = (img3x3(y, x-1)>>2) + (img3x3(y, x)>>1) + (img3x3(y, x+1)>>2); break;
-	case VERTICAL:
-	  dstLine[x] = (img3x3(y-1, x)>>2) + (img3x3(y, x)>>1) + (img3x3(y+1, x)>>2); break;
-	case DIAGONAL1:
-	  dstLine[x] = (img3x3(y-1, x+1)>>2) + (img3x3(y, x)>>1) + (img3x3(y+1, x-1)>>2); break;
-	case DIAGONAL2:
-	  dstLine[x] = (img3x3(y-1, x-1)>>2) + (img3x3(y, x)>>1) + (img3x3(y+1, x+1)>>2); break;
-	default: abort(); break;
+      }
+    }
+  }
+}
+
+// Push-based blurGaussian for images that never fully reside in memory: rows go in
+// one at a time and come out blurred getLatency() rows later. Only the padded input
+// line and the last (vRadius<<1)+1 horizontally filtered rows are kept, so memory is
+// O(width x kernel height) whatever the height. Borders are replicated, rows come out
+// as blurGaussian writes them. One stream per band.
+template <typename T>
+class cscanlinegaussian {
+public:
+  cscanlinegaussian(size_t width, double sigmaX, double sigmaY);
+  // feeds the next row, writes the row getLatency() rows above into out once there is one
+  bool push(const T *row, T *out);
+  // after the last row: writes the next pending row into out, false when all rows are out
+  bool flush(T *out);
+  void reset(void) { m_rows_in = 0, m_rows_out = 0, m_latest = -1; }
+  size_t getWidth(void) const { return m_width; }
+  size_t getLatency(void) const { return (size_t)m_vradius; }
+  size_t getRowsIn(void) const { return m_rows_in; }
+  size_t getRowsOut(void) const { return m_rows_out; }
+private:
+  void filterLine(const T *row);
+  void writeLine(T *out);
+  size_t m_width;
+  int m_hradius, m_vradius;
+  std::vector<float> m_hkernel, m_vkernel;
+  cchunk<T> m_input; // one line with the horizontal halo
+  cchunk<float> m_rows; // ring of horizontally filtered rows around the output row
+  std::vector<float> m_row;
+  std::vector<const float *> m_lines;
+  size_t m_rows_in, m_rows_out;
+  int m_latest; // row in the bottom line of the ring
+};
+
+template <typename T>
+cscanlinegaussian<T>::cscanlinegaussian(size_t width, double sigmaX, double sigmaY)
+  : m_width(width), m_rows_in(0), m_rows_out(0), m_latest(-1)
+{
+  assert(width > 0);
+  buildGaussianKernel(m_hkernel, sigmaX);
+  buildGaussianKernel(m_vkernel, sigmaY);
+  m_hradius = (int)(m_hkernel.size()>>1);
+  m_vradius = (int)(m_vkernel.size()>>1);
+  m_input.setDimension(width, 1, m_hradius, 0);
+  m_rows.setDimension(width, 1, 0, m_vradius);
+  m_row.resize(width);
+  m_lines.resize((m_vradius<<1) + 1);
+}
+
+template <typename T>
+void cscanlinegaussian<T>::filterLine(const T *row)
+{
+  m_input.shiftByLine(row);
+  const T *line = m_input.getBufferLine(0);
+  for (size_t x = 0; x < m_width; ++x) {
+    float sum = 0.0f;
+    for (int k = -m_hradius; k <= m_hradius; ++k)
+      sum += (float)line[(int)x+k] * m_hkernel[k+m_hradius];
+    m_row[x] = sum;
+  }
+}
+
+template <typename T>
+void cscanlinegaussian<T>::writeLine(T *out)
+{
+  assert(out);
+  for (int k = 0; k <= (m_vradius<<1); ++k) m_lines[k] = m_rows.getBufferLine(k);
+  for (size_t x = 0; x < m_width; ++x) {
+    float sum = 0.0f;
+    for (int k = 0; k <= (m_vradius<<1); ++k)
+      sum += m_lines[k][x] * m_vkernel[k];
+    out[x] = saturatePixel<T>(sum);
+  }
+  m_rows_out++;
+}
+
+template <typename T>
+bool cscanlinegaussian<T>::push(const T *row, T *out)
+{
+  assert(row);
+  assert(m_latest + 1 == (int)m_rows_in); // no rows after a flush
+  filterLine(row);
+  // the first row also stands for the replicated rows above the image
+  const int shifts = (m_rows_in == 0) ? (m_vradius<<1) + 1 : 1;
+  for (int i = 0; i < shifts; ++i) m_rows.shiftByLine(&m_row[0]);
+  m_rows_in++, m_latest++;
+
+  if (m_latest - m_vradius < 0) return false;
+  writeLine(out);
+  return true;
+}
+
+template <typename T>
+bool cscanlinegaussian<T>::flush(T *out)
+{
+  if (m_rows_out >= m_rows_in) return false;
+  // the last row stands for the replicated rows below the image
+  std::memcpy(&m_row[0], m_rows.getBufferLine(m_vradius<<1), m_width * sizeof(float));
+  while (m_latest - m_vradius < (int)m_rows_out) {
+    m_rows.shiftByLine(&m_row[0]);
+    m_latest++;
+  }
+  writeLine(out);
+  return true;
+}
+
+// Young & van Vliet recursive gaussian, feedback terms are pre-divided by b0
+typedef struct {
+  float B;
+  float b1, b2, b3;
+} recursive_gaussian_t;
+
+inline recursive_gaussian_t getRecursiveGaussianCoefficients(double sigma)
+{
+  recursive_gaussian_t coef = { 1.0f, 0.0f, 0.0f, 0.0f };
+  if (sigma <= 0.0) return coef;
+  if (sigma < 0.5) sigma = 0.5;
+
+  double q;
+  if (sigma >= 2.5) q = 0.98711*sigma - 0.96330;
+  else q = 3.97156 - 4.14554*std::sqrt(1.0 - 0.26891*sigma);
+
+  double b0 = 1.57825 + 2.44413*q + 1.4281*q*q + 0.422205*q*q*q;
+  double b1 = 2.44413*q + 2.85619*q*q + 1.26661*q*q*q;
+  double b2 = -(1.4281*q*q + 1.26661*q*q*q);
+  double b3 = 0.422205*q*q*q;
+
+  coef.b1 = static_cast<float>(b1 / b0);
+  coef.b2 = static_cast<float>(b2 / b0);
+  coef.b3 = static_cast<float>(b3 / b0);
+  coef.B = static_cast<float>(1.0 - (b1 + b2 + b3) / b0);
+  return coef;
+}
+
+// causal then anti-causal pass along a line, edges are replicated into the recursion
+inline void filterRecursiveLine(float *line, size_t len, const recursive_gaussian_t& coef)
+{
+  if (len == 0) return;
+
+  float w1 = line[0], w2 = line[0], w3 = line[0];
+  for (size_t x = 0; x < len; ++x) {
+    float w = coef.B*line[x] + coef.b1*w1 + coef.b2*w2 + coef.b3*w3;
+    w3 = w2, w2 = w1, w1 = w;
+    line[x] = w;
+  }
+
+  w1 = w2 = w3 = line[len-1];
+  for (size_t x = len; x-- > 0; ) {
+    float w = coef.B*line[x] + coef.b1*w1 + coef.b2*w2 + coef.b3*w3;
+    w3 = w2, w2 = w1, w1 = w;
+    line[x] = w;
+  }
+}
+
+// max deviation of the recursive impulse response from the exact normalized gaussian, over
+// the taps of buildGaussianKernel; getBoxGaussianDeviation() says the same of the box cascade
+inline double getRecursiveGaussianDeviation(double sigma)
+{
+  std::vector<float> kernel;
+  buildGaussianKernel(kernel, sigma);
+  const size_t radius = kernel.size()>>1;
+
+  // an impulse far enough from the ends that the replicated edges stay at zero
+  std::vector<float> response((radius<<2) + 1, 0.0f);
+  response[radius<<1] = 1.0f;
+  filterRecursiveLine(&response[0], response.size(), getRecursiveGaussianCoefficients(sigma));
+
+  double deviation = 0.0;
+  for (size_t i = 0; i < response.size(); ++i) {
+    const int k = (int)i - (int)(radius<<1);
+    double b = (std::abs(k) <= (int)radius) ? kernel[k+radius] : 0.0;
+    deviation = std::max(deviation, std::fabs((double)response[i] - b));
+  }
+  return deviation;
+}
+
+// recursive gaussian whose cost per pixel does not depend on sigma
+template <typename T>
+void blurRecursiveGaussian(cpixmap<T>& dst, cpixmap<T>& src, double sigmaX, double sigmaY)
+{
+  assert(dst.getWidth() == src.getWidth());
+  assert(dst.getHeight() == src.getHeight());
+  assert(dst.getBands() >= src.getBands());
+
+  const size_t width = src.getWidth();
+  const size_t height = src.getHeight();
+  const recursive_gaussian_t hCoef = getRecursiveGaussianCoefficients(sigmaX);
+  const recursive_gaussian_t vCoef = getRecursiveGaussianCoefficients(sigmaY);
+  // columns handled together by one thread during the vertical recursion
+  const size_t columns = 256;
+
+  cpixmap<float> temp; // written before it is read, see blurGaussian
+  temp.setResolution(width, height, 1, false);
+
+  for (size_t z = 0; z < src.getBands(); ++z) {
+#pragma omp parallel for
+    for (size_t y = 0; y < height; ++y) {
+      const T *srcLine = src.getLine(y, z);
+      float *tempLine = temp.getLine(y);
+      for (size_t x = 0; x < width; ++x) tempLine[x] = (float)srcLine[x];
+      filterRecursiveLine(tempLine, width, hCoef);
+    }
+
+#pragma omp parallel for
+    for (size_t x0 = 0; x0 < width; x0 += columns) {
+      const size_t len = std::min(columns, width - x0);
+      std::vector<float> edge(len);
+
+      // causal pass, top to bottom
+      std::memcpy(&edge[0], temp.getLine(0) + x0, len * sizeof(float));
+      const float *p1 = &edge[0], *p2 = &edge[0], *p3 = &edge[0];
+      for (size_t y = 0; y < height; ++y) {
+	float *line = temp.getLine(y) + x0;
+	filterRecursiveStep(line, line, p1, p2, p3, len, vCoef.B, vCoef.b1, vCoef.b2, vCoef.b3);
+	p3 = p2, p2 = p1, p1 = line;
+      }
+
+      // anti-causal pass, bottom to top
+      std::memcpy(&edge[0], temp.getLine(height-1) + x0, len * sizeof(float));
+      p1 = p2 = p3 = &edge[0];
+      for (size_t y = height; y-- > 0; ) {
+	float *line = temp.getLine(y) + x0;
+	filterRecursiveStep(line, line, p1, p2, p3, len, vCoef.B, vCoef.b1, vCoef.b2, vCoef.b3);
+	p3 = p2, p2 = p1, p1 = line;
+
+	T *dstLine = dst.getLine(y, z) + x0;
+	for (size_t x = 0; x < len; ++x) dstLine[x] = saturatePixel<T>(line[x]);
+      }
+    }
+  }
+}
+
+// widths of the box filters whose cascade approximates a gaussian of sigma (Kovesi)
+inline void getBoxGaussianWidths(std::vector<size_t>& widths, double sigma, size_t passes)
+{
+  assert(passes > 0);
+
+  double ideal = std::sqrt(12.0*sigma*sigma/passes + 1.0);
+  int lower = (int)std::floor(ideal);
+  if ((lower & 1) == 0) lower--;
+  if (lower < 1) lower = 1;
+  int upper = lower + 2;
+
+  double n = (double)passes;
+  double m = (12.0*sigma*sigma - n*lower*lower - 4.0*n*lower - 3.0*n) / (-4.0*lower - 4.0);
+  int lowerPasses = (int)std::floor(m + 0.5);
+
+  widths.resize(passes);
+  for (size_t i = 0; i < passes; ++i)
+    widths[i] = ((int)i < lowerPasses) ? lower : upper;
+}
+
+// max deviation of the cascaded box impulse response from the exact normalized gaussian
+inline double getBoxGaussianDeviation(double sigma, size_t passes)
+{
+  std::vector<size_t> widths;
+  getBoxGaussianWidths(widths, sigma, passes);
+
+  std::vector<double> response(1, 1.0);
+  for (size_t i = 0; i < widths.size(); ++i) {
+    std::vector<double> next(response.size() + widths[i] - 1, 0.0);
+    for (size_t j = 0; j < response.size(); ++j)
+      for (size_t k = 0; k < widths[i]; ++k)
+	next[j+k] += response[j] / widths[i];
+    response.swap(next);
+  }
+
+  std::vector<float> kernel;
+  buildGaussianKernel(kernel, sigma);
+
+  int boxRadius = (int)(response.size()>>1);
+  int gaussRadius = (int)(kernel.size()>>1);
+  int radius = std::max(boxRadius, gaussRadius);
+  double deviation = 0.0;
+  for (int i = -radius; i <= radius; ++i) {
+    double a = (std::abs(i) <= boxRadius) ? response[i+boxRadius] : 0.0;
+    double b = (std::abs(i) <= gaussRadius) ? kernel[i+gaussRadius] : 0.0;
+    deviation = std::max(deviation, std::fabs(a - b));
+  }
+  return deviation;
+}
+
+// approximated gaussian by a cascade of box filters, each costs O(1) per pixel by running sums.
+// more passes are closer to the exact kernel, getBoxGaussianDeviation() reports how close.
+template <typename T>
+void blurBoxGaussian(cpixmap<T>& dst, cpixmap<T>& src, double sigma, size_t passes = 3)
+{
+  assert(dst.getWidth() == src.getWidth());
+  assert(dst.getHeight() == src.getHeight());
+  assert(dst.getBands() >= src.getBands());
+
+  const size_t width = src.getWidth();
+  const size_t height = src.getHeight();
+
+  std::vector<size_t> widths;
+  getBoxGaussianWidths(widths, sigma, passes);
+  const int maxRadius = (int)(*std::max_element(widths.begin(), widths.end())>>1);
+
+  // the vertical passes read lines ahead through the border policy, so they ping-pong between two planes
+  cpixmap<float> temp, temp2; // written before they are read, see blurGaussian
+  temp.setResolution(width, height, 1, false);
+  temp2.setResolution(width, height, 1, false);
+  const size_t strips = getStripCount(height);
+
+  for (size_t z = 0; z < src.getBands(); ++z) {
+#pragma omp parallel for
+    for (size_t y = 0; y < height; ++y) {
+      const T *srcLine = src.getLine(y, z);
+      float *tempLine = temp.getLine(y);
+      std::vector<float> padded(width + ((maxRadius + 1)<<1));
+      float *line = &padded[maxRadius + 1];
+      for (size_t x = 0; x < width; ++x) line[x] = (float)srcLine[x];
+
+      for (size_t i = 0; i < widths.size(); ++i) {
+	const int r = (int)(widths[i]>>1);
+	const double scale = 1.0 / widths[i];
+	fillBorder(line, width, maxRadius + 1, BORDER_REPLICATE);
+	double sum = 0.0;
+	for (int k = -r; k <= r; ++k) sum += line[k];
+	for (size_t x = 0; x < width; ++x) {
+	  tempLine[x] = (float)(sum * scale);
+	  sum += line[(int)x+r+1] - line[(int)x-r];
+	}
+	std::memcpy(line, tempLine, width * sizeof(float));
+      }
+    }
+
+    cpixmap<float> *in = &temp, *out = &temp2;
+    for (size_t i = 0; i < widths.size(); ++i) {
+      const int r = (int)(widths[i]>>1);
+      const double scale = 1.0 / widths[i];
+
+#pragma omp parallel for
+      for (size_t s = 0; s < strips; ++s) {
+	const size_t yBegin = height * s / strips;
+	const size_t yEnd = height * (s+1) / strips;
+	cslice<float> vslice(*in, 1, 0, r);
+	vslice.draftSlice(*in, 0, yBegin);
+
+	std::vector<double> columnSum(width, 0.0);
+	for (int k = -r; k <= r; ++k) {
+	  const float *line = vslice.getLine((int)yBegin+k);
+	  for (size_t x = 0; x < width; ++x) columnSum[x] += line[x];
+	}
+
+	for (size_t y = yBegin; y < yEnd; ++y) {
+	  float *outLine = out->getLine(y);
+	  const float *outgoing = vslice.getLine((int)y-r);
+	  for (size_t x = 0; x < width; ++x) {
+	    outLine[x] = (float)(columnSum[x] * scale);
+	    columnSum[x] -= outgoing[x];
+	  }
+	  // the outgoing line leaves the slice, the incoming line enters at the bottom
+	  vslice.shiftSlice(1, *in);
+	  const float *incoming = vslice.getLine((int)y+r+1);
+	  for (size_t x = 0; x < width; ++x) columnSum[x] += incoming[x];
 	}
       }
+      std::swap(in, out);
+    }
 
-      dir3x3.shiftFrame(dirmap, z);
-      img3x3.shiftFrame(src, z);
+#pragma omp parallel for
+    for (size_t y = 0; y < height; ++y) {
+      const float *tempLine = in->getLine(y);
+      T *dstLine = dst.getLine(y, z);
+      for (size_t x = 0; x < width; ++x) dstLine[x] = saturatePixel<T>(tempLine[x]);
     }
   }
 }
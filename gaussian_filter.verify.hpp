@@ -0,0 +1,248 @@
+/*
+  Copyright (C) 2017 Hoyoung Lee
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#include <cpixmap.hpp>
+#include "gaussian_filter.direction.hpp"
+
+// Conformance of the kernels: test images, double precision references with the
+// replicated border of the window frames, and the error of an output against them.
+// The references say what a kernel should compute, not how it rounds, so every kernel
+// is held to a tolerance (see the benchmark's --verify).
+
+typedef enum {
+  TEST_IMAGE_RANDOM = 0,
+  TEST_IMAGE_MAX = 1,          // every pixel at the largest value of the type
+  TEST_IMAGE_MIN = 2,          // every pixel at the smallest value
+  TEST_IMAGE_CHECKERBOARD = 3, // min and max alternating pixel by pixel
+  NR_TEST_IMAGE = 4
+} test_image_t;
+
+const char *const testImageNames[NR_TEST_IMAGE] = { "random", "max", "min", "checkerboard" };
+
+// range the test images span, floating point images stay in [0, 255]
+template <typename T> inline double getTestMin(void)
+{
+  return std::numeric_limits<T>::is_integer ? (double)std::numeric_limits<T>::min() : 0.0;
+}
+template <typename T> inline double getTestMax(void)
+{
+  return std::numeric_limits<T>::is_integer ? (double)std::numeric_limits<T>::max() : 255.0;
+}
+
+template <typename T>
+void fillTestImage(cpixmap<T>& image, test_image_t kind, uint32_t seed = 1)
+{
+  const double lo = getTestMin<T>(), hi = getTestMax<T>();
+  uint64_t state = seed * 0x9E3779B97F4A7C15ull + 1;
+  for (size_t z = 0; z < image.getBands(); ++z) {
+    for (size_t y = 0; y < image.getHeight(); ++y) {
+      T *line = image.getLine(y, z);
+      for (size_t x = 0; x < image.getWidth(); ++x) {
+	double v;
+	switch (kind) {
+	case TEST_IMAGE_RANDOM:
+	  state = state * 6364136223846793005ull + 1442695040888963407ull;
+	  v = lo + (hi - lo) * (double)(state >> 11) / 9007199254740992.0; // 53 bits in [0, 1)
+	  if (std::numeric_limits<T>::is_integer) v = std::floor(v);
+	  break;
+	case TEST_IMAGE_MAX: v = hi; break;
+	case TEST_IMAGE_MIN: v = lo; break;
+	case TEST_IMAGE_CHECKERBOARD: v = ((x + y + z) & 1) ? hi : lo; break;
+	default: abort(); break;
+	}
+	line[x] = static_cast<T>(v);
+      }
+    }
+  }
+}
+
+// pixel of src with the coordinates clamped into the image
+template <typename T>
+inline double getClampedPixel(const cpixmap<T>& src, int x, int y, size_t z)
+{
+  x = std::min(std::max(x, 0), (int)src.getWidth() - 1);
+  y = std::min(std::max(y, 0), (int)src.getHeight() - 1);
+  return (double)src.getPixel((size_t)x, (size_t)y, z);
+}
+
+template <typename T>
+void blurGaussian3x3Double(cpixmap<double>& ref, const cpixmap<T>& src)
+{
+  static const double weight[3][3] = { { 1, 2, 1 }, { 2, 4, 2 }, { 1, 2, 1 } };
+  ref.setResolution(src.getWidth(), src.getHeight(), src.getBands(), false);
+  for (size_t z = 0; z < src.getBands(); ++z)
+    for (size_t y = 0; y < src.getHeight(); ++y)
+      for (size_t x = 0; x < src.getWidth(); ++x) {
+	double sum = 0.0;
+	for (int dy = -1; dy <= 1; ++dy)
+	  for (int dx = -1; dx <= 1; ++dx)
+	    sum += weight[dy+1][dx+1] * getClampedPixel(src, (int)x+dx, (int)y+dy, z);
+	ref.getLine(y, z)[x] = sum / 16.0;
+      }
+}
+
+// codes of a direction rule over a whole band, the rule sees an n x n neighbourhood
+// through n rows of n pixels with the pixel in the middle
+template <typename T, int N, typename R>
+void getDirectionCodes(std::vector<uint8_t>& codes, const cpixmap<T>& src, size_t z, R rule)
+{
+  const int width = (int)src.getWidth(), height = (int)src.getHeight();
+  codes.resize((size_t)width * height);
+  T rows[N][N];
+  const T *lines[N];
+  for (int i = 0; i < N; ++i) lines[i] = rows[i];
+  for (int y = 0; y < height; ++y)
+    for (int x = 0; x < width; ++x) {
+      for (int dy = 0; dy < N; ++dy)
+	for (int dx = 0; dx < N; ++dx)
+	  rows[dy][dx] = static_cast<T>(getClampedPixel(src, x+dx-N/2, y+dy-N/2, z));
+      codes[(size_t)y*width + x] = rule(lines);
+    }
+}
+
+// the majority vote of a rule over the clamped 3x3 codes
+template <typename V>
+inline uint8_t voteCodes(const std::vector<uint8_t>& codes, int width, int height, int x, int y, V vote)
+{
+  uint8_t rows[3][3];
+  for (int dy = 0; dy < 3; ++dy)
+    for (int dx = 0; dx < 3; ++dx) {
+      int cx = std::min(std::max(x+dx-1, 0), width-1), cy = std::min(std::max(y+dy-1, 0), height-1);
+      rows[dy][dx] = codes[(size_t)cy*width + cx];
+    }
+  return vote(rows[0], rows[1], rows[2], 1);
+}
+
+template <typename T>
+struct direction3x1_rule {
+  uint8_t operator()(const T *const *lines) const { return getDirection3x1(lines[0], lines[1], lines[2], 1); }
+};
+
+template <typename T>
+struct direction5x1_rule {
+  uint8_t operator()(const T *const *lines) const { return getDirection5x1(lines, 2); }
+};
+
+// 1/4-1/2-1/4 along the voted direction
+template <typename T>
+void blurDirectionalGaussian3x1Double(cpixmap<double>& ref, const cpixmap<T>& src)
+{
+  static const int taps[NR_DIRECTION][2] = { { 0, 0 }, { 1, 0 }, { 0, 1 }, { -1, 1 }, { 1, 1 } }; // (dx, dy) of next
+  const int width = (int)src.getWidth(), height = (int)src.getHeight();
+  ref.setResolution(src.getWidth(), src.getHeight(), src.getBands(), false);
+  std::vector<uint8_t> codes;
+  for (size_t z = 0; z < src.getBands(); ++z) {
+    getDirectionCodes<T, 3>(codes, src, z, direction3x1_rule<T>());
+    for (int y = 0; y < height; ++y)
+      for (int x = 0; x < width; ++x) {
+	uint8_t dir = voteCodes(codes, width, height, x, y, voteDirection3x1);
+	assert(dir != UNDIRECTIONAL);
+	const int dx = taps[dir][0], dy = taps[dir][1];
+	ref.getLine(y, z)[x] = 0.25 * getClampedPixel(src, x-dx, y-dy, z) + 0.5 * getClampedPixel(src, x, y, z) +
+	  0.25 * getClampedPixel(src, x+dx, y+dy, z);
+      }
+  }
+}
+
+// 1-4-6-4-1 / 16 along the voted orientation
+template <typename T>
+void blurDirectionalGaussian5x1Double(cpixmap<double>& ref, const cpixmap<T>& src)
+{
+  const int width = (int)src.getWidth(), height = (int)src.getHeight();
+  ref.setResolution(src.getWidth(), src.getHeight(), src.getBands(), false);
+  std::vector<uint8_t> codes;
+  for (size_t z = 0; z < src.getBands(); ++z) {
+    getDirectionCodes<T, 5>(codes, src, z, direction5x1_rule<T>());
+    for (int y = 0; y < height; ++y)
+      for (int x = 0; x < width; ++x) {
+	uint8_t dir = voteCodes(codes, width, height, x, y, voteDirection5x1);
+	const int *t = orientationTaps[dir];
+	ref.getLine(y, z)[x] =
+	  (getClampedPixel(src, x-t[2], y-t[3], z) + 4.0 * getClampedPixel(src, x-t[0], y-t[1], z) +
+	   6.0 * getClampedPixel(src, x, y, z) +
+	   4.0 * getClampedPixel(src, x+t[0], y+t[1], z) + getClampedPixel(src, x+t[2], y+t[3], z)) / 16.0;
+      }
+  }
+}
+
+// the separable gaussian with weights in double, radius as in buildGaussianKernel
+template <typename T>
+void blurGaussianDouble(cpixmap<double>& ref, const cpixmap<T>& src, double sigmaX, double sigmaY)
+{
+  const double sigma[2] = { sigmaX, sigmaY };
+  std::vector<double> kernel[2];
+  for (int i = 0; i < 2; ++i) {
+    const int radius = (sigma[i] <= 0.0) ? 0 : (int)std::ceil(3.0 * sigma[i]);
+    kernel[i].assign((radius<<1) + 1, 1.0);
+    if (radius == 0) continue;
+    double sum = 0.0;
+    for (int k = -radius; k <= radius; ++k) sum += kernel[i][k+radius] = std::exp(-(double)(k*k) / (2.0*sigma[i]*sigma[i]));
+    for (size_t k = 0; k < kernel[i].size(); ++k) kernel[i][k] /= sum;
+  }
+  const int hRadius = (int)(kernel[0].size()>>1), vRadius = (int)(kernel[1].size()>>1);
+  const int width = (int)src.getWidth(), height = (int)src.getHeight();
+
+  ref.setResolution(src.getWidth(), src.getHeight(), src.getBands(), false);
+  std::vector<double> temp((size_t)width * height);
+  for (size_t z = 0; z < src.getBands(); ++z) {
+    for (int y = 0; y < height; ++y)
+      for (int x = 0; x < width; ++x) {
+	double sum = 0.0;
+	for (int k = -hRadius; k <= hRadius; ++k) sum += kernel[0][k+hRadius] * getClampedPixel(src, x+k, y, z);
+	temp[(size_t)y*width + x] = sum;
+      }
+    for (int y = 0; y < height; ++y)
+      for (int x = 0; x < width; ++x) {
+	double sum = 0.0;
+	for (int k = -vRadius; k <= vRadius; ++k)
+	  sum += kernel[1][k+vRadius] * temp[(size_t)std::min(std::max(y+k, 0), height-1)*width + x];
+	ref.getLine(y, z)[x] = sum;
+      }
+  }
+}
+
+typedef struct {
+  double max, mean; // absolute error
+  size_t worst_x, worst_y, worst_z;
+} error_stats_t;
+
+template <typename T>
+error_stats_t measureError(const cpixmap<T>& out, const cpixmap<double>& ref)
+{
+  assert(out.getWidth() == ref.getWidth() && out.getHeight() == ref.getHeight());
+  assert(out.getBands() >= ref.getBands());
+  error_stats_t stats = { 0.0, 0.0, 0, 0, 0 };
+  double sum = 0.0;
+  for (size_t z = 0; z < ref.getBands(); ++z)
+    for (size_t y = 0; y < ref.getHeight(); ++y)
+      for (size_t x = 0; x < ref.getWidth(); ++x) {
+	double error = std::fabs((double)out.getPixel(x, y, z) - ref.getPixel(x, y, z));
+	if (!(error <= stats.max)) stats.max = error, stats.worst_x = x, stats.worst_y = y, stats.worst_z = z; // NaN is the worst
+	sum += error;
+      }
+  const size_t count = ref.getWidth() * ref.getHeight() * ref.getBands();
+  stats.mean = count ? sum / (double)count : 0.0;
+  return stats;
+}